@@ -19,78 +19,237 @@
  * BMP image reader/writer kindly provided by 'deqmega' https://github.com/DEQ2000-cyber
  */
 
-static unsigned char *
-loadBMP(char *file, unsigned int *w, unsigned int *h, unsigned char *bpp,
-        void *(*calloc_func)(size_t, size_t))
+#ifndef BMP_RW_MMAP
+#if defined(_WIN32) || defined(__unix__) || defined(__APPLE__)
+#define BMP_RW_MMAP 1
+#else
+#define BMP_RW_MMAP 0
+#endif
+#endif
+
+#if BMP_RW_MMAP && defined(_WIN32)
+#include <windows.h>
+#elif BMP_RW_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define BMP_HEADER_SIZE 54
+#define BMP_CHUNK       256 /* pixels converted per fread */
+
+struct BMP_INFO {
+    unsigned long offset; /* of the pixel data */
+    int w, h;
+    int bypp; /* bytes per pixel, 3 or 4 */
+    int topdown;
+    int stride; /* bytes per row including the padding */
+};
+
+static long
+get32(const unsigned char *p)
 {
-    FILE *f;
-    unsigned char header[54];
-    unsigned char pad[3];
-    unsigned char *data = NULL;
-    unsigned int width, height, size;
-    unsigned char BPP, padding;
-    unsigned int X;
-    int Y;
-    
-    f = fopen(file, "rb");
-    if (f == NULL) {
-        return NULL;
-    }
-    fread(header, sizeof(unsigned char), 54, f);
-    width = *(int*) &header[18];
-    height = *(int*) &header[22];
-    BPP = *(int*) &header[28];
-    size = (width * height * (BPP / 8));
-    padding = ((4 - (width * (BPP / 8)) % 4) % 4);
-    data = calloc_func(size, (BPP / 8));
-    if (data == NULL) {
-        return NULL;
+    unsigned long v;
+
+    v = (unsigned long) p[0] | ((unsigned long) p[1] << 8) |
+        ((unsigned long) p[2] << 16) | ((unsigned long) p[3] << 24);
+    if (v & 0x80000000UL) {
+        return -(long) (0xffffffffUL - v) - 1;
+    }
+    return (long) v;
+}
+
+static int
+parse_header(const unsigned char *header, struct BMP_INFO *bi)
+{
+    long w, h;
+    int bpp;
+
+    if (header[0] != 'B' || header[1] != 'M') {
+        return 0;
+    }
+    bi->offset = (unsigned long) get32(header + 10);
+    w = get32(header + 18);
+    h = get32(header + 22);
+    bpp = header[28] | (header[29] << 8);
+    bi->topdown = (h < 0);
+    if (h < 0) {
+        h = -h;
+    }
+    if (w <= 0 || h <= 0 || w > 0x8000 || h > 0x8000 ||
+        (bpp != 24 && bpp != 32) || bi->offset < BMP_HEADER_SIZE) {
+        return 0;
     }
-    fseek(f, 54, SEEK_SET);
-    for (Y = height - 1; Y >= 0; Y--) {
-        for (X = 0; X < width; X++) {
-            fread(&data[(Y * width + X) * (BPP / 8)], (BPP / 8), 1, f);
+    bi->w = w;
+    bi->h = h;
+    bi->bypp = bpp / 8;
+    bi->stride = (bi->w * bi->bypp + 3) & ~3;
+    return 1;
+}
+
+/* 24-bit pixels get an opaque alpha, 32-bit ones are kept as they are */
+static void
+convert_row(const unsigned char *p, unsigned int *out, int n, int bypp)
+{
+    int i;
+
+    if (bypp == 4) {
+        for (i = 0; i < n; i++, p += 4) {
+            out[i] = (unsigned int) p[0] | ((unsigned int) p[1] << 8) |
+                     ((unsigned int) p[2] << 16) | ((unsigned int) p[3] << 24);
+        }
+    } else {
+        for (i = 0; i < n; i++, p += 3) {
+            out[i] = (unsigned int) p[0] | ((unsigned int) p[1] << 8) |
+                     ((unsigned int) p[2] << 16) | 0xff000000U;
         }
-        fread(pad, padding, 1, f);
     }
-    fclose(f), f = NULL;
-    *w = width;
-    *h = height;
-    *bpp = BPP;
-    return data;
 }
 
-static void *
-loadBMPconverter(char *file, int *w, int *h,
-        void *(*calloc_func)(size_t, size_t))
+/* rows are stored bottom-up unless the height is negative */
+static unsigned int *
+dst_row(int *color, struct BMP_INFO *bi, int y)
 {
-    unsigned int *data = NULL;
-    unsigned int x, y, i;
-    unsigned char n;
-    unsigned char *p;
-    unsigned int *pix;
-    
-    p = loadBMP(file, &x, &y, &n, calloc_func);
-    if (p == NULL) {
-        return NULL;
+    if (!bi->topdown) {
+        y = bi->h - 1 - y;
     }
-    *w = x;
-    *h = y;
-    data = calloc_func(x * y, sizeof(unsigned int));
+    return (unsigned int *) color + (long) y * bi->w;
+}
+
+#if BMP_RW_MMAP
+/* decode straight out of a mapping of the file
+ * returns -1 if the file could not be mapped (so it gets read normally)
+ */
+static int
+read_mapped(char *file, int *color, int maxpix, int *out_w, int *out_h)
+{
+    const unsigned char *data;
+    unsigned long size;
+    struct BMP_INFO bi;
+    int y, ok = 0;
+#ifdef _WIN32
+    HANDLE fh, mh;
+    DWORD hi, lo;
+
+    fh = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL,
+                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    lo = GetFileSize(fh, &hi);
+    if (hi != 0 || lo < BMP_HEADER_SIZE) {
+        CloseHandle(fh);
+        return -1;
+    }
+    mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mh == NULL) {
+        CloseHandle(fh);
+        return -1;
+    }
+    data = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
     if (data == NULL) {
-        return NULL;
+        CloseHandle(mh);
+        CloseHandle(fh);
+        return -1;
+    }
+    size = lo;
+#else
+    struct stat st;
+    void *p;
+    int fd;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        st.st_size < BMP_HEADER_SIZE) {
+        close(fd);
+        return -1;
+    }
+    p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return -1;
     }
-    pix = data;
-    if ((n / 8) == 4) {
-        memcpy(pix, p, (x * y * sizeof(unsigned int)));
-        free(p);
-        return data;
+    data = p;
+    size = (unsigned long) st.st_size;
+#endif
+    if (!parse_header(data, &bi)) {
+        goto done;
     }
-    for (i = 0; i < (x * y * (n / 8)); i += (n / 8)) {
-        *(pix++) = (p[i] << 0) | (p[i + 1] << 8) | (p[i + 2] << 16) | (255 << 24);
+    *out_w = bi.w;
+    *out_h = bi.h;
+    if ((long) bi.w * bi.h > maxpix ||
+        bi.offset + (unsigned long) bi.stride * (bi.h - 1) +
+        (unsigned long) bi.w * bi.bypp > size) {
+        goto done;
     }
-    free(p);
-    return data;
+    for (y = 0; y < bi.h; y++) {
+        convert_row(data + bi.offset + (unsigned long) bi.stride * y,
+                    dst_row(color, &bi, y), bi.w, bi.bypp);
+    }
+    ok = 1;
+done:
+#ifdef _WIN32
+    UnmapViewOfFile((void *) data);
+    CloseHandle(mh);
+    CloseHandle(fh);
+#else
+    munmap((void *) data, (size_t) size);
+#endif
+    return ok;
+}
+#endif
+
+static int
+read_stdio(char *file, int *color, int maxpix, int *out_w, int *out_h)
+{
+    FILE *f;
+    unsigned char header[BMP_HEADER_SIZE];
+    unsigned char buf[BMP_CHUNK * 4];
+    struct BMP_INFO bi;
+    unsigned int *row;
+    int x, y, n, pad;
+
+    f = fopen(file, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) ||
+        !parse_header(header, &bi)) {
+        goto err;
+    }
+    *out_w = bi.w;
+    *out_h = bi.h;
+    if ((long) bi.w * bi.h > maxpix ||
+        fseek(f, (long) bi.offset, SEEK_SET) != 0) {
+        goto err;
+    }
+    pad = bi.stride - bi.w * bi.bypp;
+    for (y = 0; y < bi.h; y++) {
+        row = dst_row(color, &bi, y);
+        for (x = 0; x < bi.w; x += n) {
+            n = bi.w - x;
+            if (n > BMP_CHUNK) {
+                n = BMP_CHUNK;
+            }
+            if (fread(buf, bi.bypp, n, f) != (size_t) n) {
+                goto err;
+            }
+            convert_row(buf, row + x, n, bi.bypp);
+        }
+        /* the last row may be missing its padding */
+        if (pad && y < bi.h - 1 && fread(buf, 1, pad, f) != (size_t) pad) {
+            goto err;
+        }
+    }
+    fclose(f);
+    return 1;
+err:
+    fclose(f);
+    return 0;
 }
 
 static int
@@ -99,18 +258,16 @@ saveBMP(char *file, int *data, unsigned int w,
 {
     FILE *f;
     unsigned int filesize;
-    unsigned char pad[3], header[14], info[40];
-    unsigned char padding;
-    unsigned int X;
+    unsigned char header[14], info[40];
     int Y, bpp = 4;
     
     if (data == NULL) {
         return 0;
     }
-    padding = ((4 - (w * bpp) % 4) % 4);
     memset(header, 0, sizeof(header));
     memset(info, 0, sizeof(info));
-    filesize = 14 + 40 + w * h * bpp + padding * w;
+    /* 32-bit rows never need padding */
+    filesize = 14 + 40 + w * h * bpp;
     header[0] = 'B';
     header[1] = 'M';
     header[2] = filesize;
@@ -135,22 +292,61 @@ saveBMP(char *file, int *data, unsigned int w,
     }
     fwrite(header, 14, 1, f);
     fwrite(info, 40, 1, f);
+    /* a whole row per fwrite */
     for (Y = h - 1; Y >= 0; Y--) {
-        for (X = 0; X < w; X++) {
-            fwrite(&data[Y * w + X], sizeof(int), 1, f);
+        if (fwrite(&data[Y * w], sizeof(int), w, f) != w) {
+            fclose(f);
+            return 0;
         }
-        fwrite(pad, padding, 1, f);
     }
-    fclose(f);
-    return 1;
+    return (fclose(f) == 0);
+}
+
+extern int
+bmp_read24_buf(char *file, int *color, int maxpix, int *out_w, int *out_h)
+{
+#if BMP_RW_MMAP
+    int ok;
+
+    ok = read_mapped(file, color, maxpix, out_w, out_h);
+    if (ok >= 0) {
+        return ok;
+    }
+#endif
+    return read_stdio(file, color, maxpix, out_w, out_h);
 }
 
 extern int
 bmp_read24(char *file, int **out_color, int *out_w, int *out_h,
         void *(*calloc_func)(size_t, size_t))
 {
-    *out_color = loadBMPconverter(file, out_w, out_h, calloc_func);
-    return (*out_color != NULL);
+    unsigned char header[BMP_HEADER_SIZE];
+    struct BMP_INFO bi;
+    FILE *f;
+    int ok;
+
+    *out_color = NULL;
+    /* only the header is needed to know how much to allocate */
+    f = fopen(file, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    ok = (fread(header, 1, sizeof(header), f) == sizeof(header)) &&
+         parse_header(header, &bi);
+    fclose(f);
+    if (!ok) {
+        return 0;
+    }
+    *out_color = calloc_func((size_t) bi.w * bi.h, sizeof(int));
+    if (*out_color == NULL) {
+        return 0;
+    }
+    if (!bmp_read24_buf(file, *out_color, bi.w * bi.h, out_w, out_h)) {
+        free(*out_color);
+        *out_color = NULL;
+        return 0;
+    }
+    return 1;
 }
 
 extern int
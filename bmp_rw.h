@@ -15,6 +15,11 @@
  *
  * Routines to read and write BMP images. Kindly provided by 'deqmega' https://github.com/DEQ2000-cyber
  *
+ * 24 and 32-bit images are read, pixels are packed ints (0xAARRGGBB, the
+ * alpha of 24-bit images is 0xff). Images are written as 32-bit.
+ * Where the OS supports it the file is memory mapped when reading,
+ * compile with -DBMP_RW_MMAP=0 to always use stdio.
+ *
  */
 
 extern int bmp_read24(char *file,
@@ -22,6 +27,14 @@ extern int bmp_read24(char *file,
         int *out_w, int *out_h,
         void *(*calloc_func)(size_t, size_t));
 
+/* Reads an image into a caller provided buffer of maxpix ints, no allocation.
+ * out_w and out_h are set as soon as the header is read, so if the image
+ * doesn't fit (returns 0) they give the size needed.
+ * returns 0 if the file can't be read or the image is larger than maxpix
+ */
+extern int bmp_read24_buf(char *file, int *color, int maxpix,
+        int *out_w, int *out_h);
+
 extern int bmp_write24(char *name, int *color, int w, int h);
 
 #endif
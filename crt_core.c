@@ -15,6 +15,8 @@
 
 /* ensure negative values for x get properly modulo'd */
 #define POSMOD(x, n)     (((x) % (n) + (n)) % (n))
+/* x % CRT_CC_SAMPLES for 0 <= x < 2 * CRT_CC_SAMPLES */
+#define CC_WRAP(x)       ((x) >= CRT_CC_SAMPLES ? (x) - CRT_CC_SAMPLES : (x))
 
 static int sigpsin15[18] = { /* significant points on sine wave (15-bit) */
     0x0000,
@@ -77,31 +79,40 @@ crt_bpp4fmt(int format)
     }
 }
 
+extern int
+crt_offsets4fmt(int format, int *r, int *g, int *b)
+{
+    switch (format) {
+        case CRT_PIX_FORMAT_RGB:
+        case CRT_PIX_FORMAT_RGBA:
+            *r = 0; *g = 1; *b = 2;
+            break;
+        case CRT_PIX_FORMAT_BGR: 
+        case CRT_PIX_FORMAT_BGRA:
+            *r = 2; *g = 1; *b = 0;
+            break;
+        case CRT_PIX_FORMAT_ARGB:
+            *r = 1; *g = 2; *b = 3;
+            break;
+        case CRT_PIX_FORMAT_ABGR:
+            *r = 3; *g = 2; *b = 1;
+            break;
+        default:
+            *r = *g = *b = 0;
+            break;
+    }
+    return crt_bpp4fmt(format);
+}
+
 /*****************************************************************************/
 /********************************* FILTERS ***********************************/
 /*****************************************************************************/
 
-/* convolution is much faster but the EQ looks softer, more authentic, and more analog */
-#define USE_CONVOLUTION 0
-#define USE_7_SAMPLE_KERNEL 1
-#define USE_6_SAMPLE_KERNEL 0
-#define USE_5_SAMPLE_KERNEL 0
-
-#if (CRT_CC_SAMPLES != 4)
-/* the current convolutions do not filter properly at > 4 samples */
-#undef USE_CONVOLUTION
-#define USE_CONVOLUTION 0
-#endif
-
 #if USE_CONVOLUTION
 
 /* NOT 3 band equalizer, faster convolution instead.
  * eq function names preserved to keep code clean
  */
-static struct EQF {
-    int h[7];
-} eqY, eqI, eqQ;
-
 /* params unused to keep the function the same */
 static void
 init_eq(struct EQF *f,
@@ -111,57 +122,70 @@ init_eq(struct EQF *f,
     memset(f, 0, sizeof(struct EQF));
 }
 
-static void
-reset_eq(struct EQF *f)
-{
-    memset(f->h, 0, sizeof(f->h));
-}
-
-static int
-eqf(struct EQF *f, int s)
-{
-    int i;
-    int *h = f->h;
-
-    for (i = 6; i > 0; i--) {
-        h[i] = h[i - 1];
-    }
-    h[0] = s;
+/* kernel weights, newest sample first */
 #if USE_7_SAMPLE_KERNEL
-    /* index : 0 1 2 3 4 5 6 */
-    /* weight: 1 4 7 8 7 4 1 */
-    return (s + h[6] + ((h[1] + h[5]) * 4) + ((h[2] + h[4]) * 7) + (h[3] * 8)) >> 5;
+#define EQ_TAPS  7
+#define EQ_SHIFT 5
+static const int eq_w[EQ_TAPS] = { 1, 4, 7, 8, 7, 4, 1 };
 #elif USE_6_SAMPLE_KERNEL
-    /* index : 0 1 2 3 4 5 */
-    /* weight: 1 3 4 4 3 1 */
-    return (s + h[5] + 3 * (h[1] + h[4]) + 4 * (h[2] + h[3])) >> 4;
+#define EQ_TAPS  6
+#define EQ_SHIFT 4
+static const int eq_w[EQ_TAPS] = { 1, 3, 4, 4, 3, 1 };
 #elif USE_5_SAMPLE_KERNEL
-    /* index : 0 1 2 3 4 */
-    /* weight: 1 2 2 2 1 */
-    return (s + h[4] + ((h[1] + h[2] + h[3]) << 1)) >> 3;
+#define EQ_TAPS  5
+#define EQ_SHIFT 3
+static const int eq_w[EQ_TAPS] = { 1, 2, 2, 2, 1 };
 #else
-    /* index : 0 1 2 3 */
-    /* weight: 1 1 1 1*/
-    return (s + h[3] + h[1] + h[2]) >> 2;
+#define EQ_TAPS  4
+#define EQ_SHIFT 2
+static const int eq_w[EQ_TAPS] = { 1, 1, 1, 1 };
 #endif
+
+/* run the kernel over the scan line in out[L, R) in place.
+ * every sample only depends on the input samples before it, so going from
+ * right to left there is no history to keep and no dependency between
+ * samples, which leaves the compiler free to vectorize it
+ */
+static void
+eq_block(struct EQF *eq, struct CRT_YIQ *out, int L, int R)
+{
+    int i, t;
+    
+    (void) eq;
+    /* samples with a full history */
+    for (i = R - 1; i >= (L + EQ_TAPS - 1); i--) {
+        int y = 0, c = 0, q = 0;
+        for (t = 0; t < EQ_TAPS; t++) {
+            y += eq_w[t] * out[i - t].y;
+            c += eq_w[t] * out[i - t].i;
+            q += eq_w[t] * out[i - t].q;
+        }
+        out[i].y = y >> EQ_SHIFT;
+        out[i].i = c >> EQ_SHIFT;
+        out[i].q = q >> EQ_SHIFT;
+    }
+    /* the first few, everything before L is zero */
+    for (; i >= L; i--) {
+        int y = 0, c = 0, q = 0;
+        for (t = 0; t <= (i - L); t++) {
+            y += eq_w[t] * out[i - t].y;
+            c += eq_w[t] * out[i - t].i;
+            q += eq_w[t] * out[i - t].q;
+        }
+        out[i].y = y >> EQ_SHIFT;
+        out[i].i = c >> EQ_SHIFT;
+        out[i].q = q >> EQ_SHIFT;
+    }
 }
 
 #else
 
-#define HISTLEN     3
 #define HISTOLD     (HISTLEN - 1) /* oldest entry */
 #define HISTNEW     0             /* newest entry */
 
 #define EQ_P        16 /* if changed, the gains will need to be adjusted */
 #define EQ_R        (1 << (EQ_P - 1)) /* rounding */
-/* three band equalizer */
-static struct EQF {
-    int lf, hf; /* fractions */
-    int g[3]; /* gains */
-    int fL[4];
-    int fH[4];
-    int h[HISTLEN]; /* history */
-} eqY, eqI, eqQ;
+/* three band equalizer, see struct EQF in crt_core.h */
 
 /* f_lo - low cutoff frequency
  * f_hi - high cutoff frequency
@@ -195,44 +219,431 @@ init_eq(struct EQF *f,
 #endif
 }
 
+/* run the equalizers of Y, I, and Q (eq[0], eq[1], eq[2]) over the scan line
+ * in out[L, R) in place, starting from a reset state.
+ * every filter depends on its own previous output so the samples have to be
+ * done in order. instead the three equalizers run side by side as lanes,
+ * with all of their state in local variables instead of struct EQF
+ */
+static void
+eq_block(struct EQF *eq, struct CRT_YIQ *out, int L, int R)
+{
+    int lf[3], hf[3], g[3][3];
+    int fL[4][3], fH[4][3], h[HISTLEN][3];
+    int i, j, k;
+    
+    for (k = 0; k < 3; k++) {
+        lf[k] = eq[k].lf;
+        hf[k] = eq[k].hf;
+        for (j = 0; j < 3; j++) {
+            g[j][k] = eq[k].g[j];
+        }
+    }
+    memset(fL, 0, sizeof(fL));
+    memset(fH, 0, sizeof(fH));
+    memset(h, 0, sizeof(h));
+    
+    for (i = L; i < R; i++) {
+        int s[3], r[3];
+        
+        s[0] = out[i].y;
+        s[1] = out[i].i;
+        s[2] = out[i].q;
+        for (k = 0; k < 3; k++) {
+            fL[0][k] += (lf[k] * (s[k] - fL[0][k]) + EQ_R) >> EQ_P;
+            fH[0][k] += (hf[k] * (s[k] - fH[0][k]) + EQ_R) >> EQ_P;
+        }
+        for (j = 1; j < 4; j++) {
+            for (k = 0; k < 3; k++) {
+                fL[j][k] += (lf[k] * (fL[j - 1][k] - fL[j][k]) + EQ_R) >> EQ_P;
+                fH[j][k] += (hf[k] * (fH[j - 1][k] - fH[j][k]) + EQ_R) >> EQ_P;
+            }
+        }
+        for (k = 0; k < 3; k++) {
+            r[k] = ((fL[3][k] * g[0][k]) >> EQ_P) +
+                   (((fH[3][k] - fL[3][k]) * g[1][k]) >> EQ_P) +
+                   (((h[HISTOLD][k] - fH[3][k]) * g[2][k]) >> EQ_P);
+        }
+        for (j = HISTOLD; j > 0; j--) {
+            for (k = 0; k < 3; k++) {
+                h[j][k] = h[j - 1][k];
+            }
+        }
+        for (k = 0; k < 3; k++) {
+            h[HISTNEW][k] = s[k];
+        }
+        out[i].y = r[0];
+        out[i].i = r[1];
+        out[i].q = r[2];
+    }
+}
+
+#endif
+
+/*****************************************************************************/
+/********************************** NOISE ************************************/
+/*****************************************************************************/
+
+/* the noise is an LCG: rn = (NOISE_A * rn + NOISE_C) mod 2^32 */
+#define NOISE_A     214019u
+#define NOISE_C     140327895u
+/* samples generated per step by add_noise() */
+#define NOISE_LANES 8
+
+/* get the multiplier and increment that advance the LCG by n steps at once */
 static void
-reset_eq(struct EQF *f)
+lcg_jump(int n, unsigned *mul, unsigned *add)
 {
-    memset(f->fL, 0, sizeof(f->fL));
-    memset(f->fH, 0, sizeof(f->fH));
-    memset(f->h, 0, sizeof(f->h));
+    unsigned a = NOISE_A, c = NOISE_C; /* 1, 2, 4, 8 ... steps */
+    unsigned ra = 1, rc = 0;
+    
+    while (n > 0) {
+        if (n & 1) {
+            ra *= a;
+            rc = rc * a + c;
+        }
+        c = c * a + c;
+        a *= a;
+        n >>= 1;
+    }
+    *mul = ra;
+    *add = rc;
 }
 
+#if ((CRT_SYSTEM == CRT_SYSTEM_NTSCVHS) && CRT_VHS_NOISE)
+/* step the LCG once, returns 0 to 32767 like rand() */
 static int
-eqf(struct EQF *f, int s)
-{    
-    int i, r[3];
+lcg_rand(int *seed)
+{
+    *seed = (int) ((unsigned) *seed * NOISE_A + NOISE_C);
+    return (*seed >> 16) & 0x7fff;
+}
 
-    f->fL[0] += (f->lf * (s - f->fL[0]) + EQ_R) >> EQ_P;
-    f->fH[0] += (f->hf * (s - f->fH[0]) + EQ_R) >> EQ_P;
+/* the bottom of the field gets replaced with the noise bands you get from a
+ * VHS head that is not tracking very well, the band is placed once per field
+ */
+static void
+tracking_setup(struct CRT *v, int *seed)
+{
+    unsigned a, c;
     
-    for (i = 1; i < 4; i++) {
-        f->fL[i] += (f->lf * (f->fL[i - 1] - f->fL[i]) + EQ_R) >> EQ_P;
-        f->fH[i] += (f->hf * (f->fH[i - 1] - f->fH[i]) + EQ_R) >> EQ_P;
+    v->vhs_freq = ((lcg_rand(seed) % 8) - 4) + 14;
+    v->vhs_beg = CRT_INPUT_SIZE - CRT_HRES * (16 + ((lcg_rand(seed) % 20) - 10));
+    v->vhs_end = CRT_INPUT_SIZE - CRT_HRES * (5 + ((lcg_rand(seed) % 8) - 4));
+    v->vhs_seed = *seed;
+    /* one step per sample of the band */
+    if (v->vhs_end > v->vhs_beg + 1) {
+        lcg_jump(v->vhs_end - (v->vhs_beg + 1), &a, &c);
+        *seed = (int) ((unsigned) *seed * a + c);
     }
+}
+
+/* put in the part of the band that is in [from, to) of the field,
+ * dst holds the samples of the field from pos on
+ */
+static void
+tracking_band(struct CRT *v, signed char *dst, int pos, int from, int to)
+{
+    int i, seed;
+    int nn = 0, ln = -1;
+    unsigned a, c;
     
-    r[0] = f->fL[3];
-    r[1] = f->fH[3] - f->fL[3];
-    r[2] = f->h[HISTOLD] - f->fH[3];
+    if (from < v->vhs_beg + 1) {
+        from = v->vhs_beg + 1;
+    }
+    if (to > v->vhs_end) {
+        to = v->vhs_end;
+    }
+    if (from >= to) {
+        return;
+    }
+    lcg_jump(from - (v->vhs_beg + 1), &a, &c);
+    seed = (int) ((unsigned) v->vhs_seed * a + c);
+    for (i = from; i < to; i++) {
+        int s;
+        
+        if (ln != (i * v->vhs_freq) / CRT_HRES) {
+            int sn, cs;
+            
+            ln = (i * v->vhs_freq) / CRT_HRES;
+            crt_sincos14(&sn, &cs, ln * 8192 / 180);
+            nn = cs >> 8;
+        }
+        seed = (int) ((unsigned) seed * NOISE_A + NOISE_C);
+        s = (((seed >> 16) & 0xff) - 0x7f) * nn;
+        s = v->analog[i] + (s >> 8);
+        dst[i - pos] = (s > 127) ? 127 : (s < -127) ? -127 : s;
+    }
+}
+#endif
 
-    for (i = 0; i < 3; i++) {
-        r[i] = (r[i] * f->g[i]) >> EQ_P;
+/* inp = analog + noise for n samples, seed is the LCG state before the
+ * first one. same numbers as running the LCG once per sample but
+ * NOISE_LANES independent generators each do every NOISE_LANES'th sample so
+ * there is no dependency from one sample to the next
+ */
+static void
+noise_samples(signed char *inp, const signed char *analog, int n, int noise,
+              unsigned seed)
+{
+    unsigned x[NOISE_LANES];
+    unsigned a, c;
+    int i, k;
+    
+    x[0] = seed * NOISE_A + NOISE_C;
+    for (k = 1; k < NOISE_LANES; k++) {
+        x[k] = x[k - 1] * NOISE_A + NOISE_C;
     }
-  
-    for (i = HISTOLD; i > 0; i--) {
-        f->h[i] = f->h[i - 1];
+    lcg_jump(NOISE_LANES, &a, &c);
+    for (i = 0; i <= (n - NOISE_LANES); i += NOISE_LANES) {
+        for (k = 0; k < NOISE_LANES; k++) {
+            int s;
+            
+            s = ((int) (x[k] >> 16 & 0xff) - 0x7f) * noise;
+            s = analog[i + k] + (s >> 8);
+            s = (s > 127) ? 127 : (s < -127) ? -127 : s;
+            inp[i + k] = s;
+            x[k] = x[k] * a + c;
+        }
+    }
+    for (k = 0; k < (n % NOISE_LANES); k++) {
+        int s;
+        
+        s = ((int) (x[k] >> 16 & 0xff) - 0x7f) * noise;
+        s = analog[i + k] + (s >> 8);
+        s = (s > 127) ? 127 : (s < -127) ? -127 : s;
+        inp[i + k] = s;
     }
-    f->h[HISTNEW] = s;
+}
+
+static void
+add_noise(signed char *inp, signed char *analog, int noise, int *seed)
+{
+    unsigned a, c;
+    
+    noise_samples(inp, analog, CRT_INPUT_SIZE, noise, (unsigned) *seed);
+    lcg_jump(CRT_INPUT_SIZE, &a, &c);
+    *seed = (int) ((unsigned) *seed * a + c);
+}
+
+/* first row of an image h rows high covered by an active line (or the row
+ * after its last when 'next' is set), depends on the field found by the
+ * sync pass
+ */
+static int
+line_to_row_h(struct CRT *v, int h, int line, int next)
+{
+    int ratio;
+
+    /* ratio of output height to active video lines in the signal */
+    ratio = (h << 16) / CRT_LINES;
+    ratio = (ratio + 32768) >> 16;
     
-    return (r[0] + r[1] + r[2]);
+    return (line - CRT_TOP + next) * (h + v->v_fac) / CRT_LINES
+            + (v->field * (ratio / 2));
+}
+
+/* same for the output image */
+static int
+line_to_row(struct CRT *v, int line, int next)
+{
+    return line_to_row_h(v, v->outh, line, next);
 }
 
+/* run a scan line through the equalizers, demodulating I and Q with the
+ * wave tables found by the sync pass.
+ * done a whole line per step so every step is a simple loop
+ */
+static void
+eq_line(struct EQF *eq, signed char *sig, int *waveI, int *waveQ, int bright,
+        struct CRT_YIQ *out, int L, int R)
+{
+    int i;
+    
+#if (CRT_CC_SAMPLES != 4)
+    int ph = L % CRT_CC_SAMPLES; /* i % CRT_CC_SAMPLES */
 #endif
+    
+    for (i = L; i < R; i++) {
+        out[i].y = sig[i] + bright;
+#if (CRT_CC_SAMPLES == 4)
+        out[i].i = sig[i] * waveI[i & 3] >> 9;
+        out[i].q = sig[i] * waveQ[i & 3] >> 9;
+#else
+        out[i].i = sig[i] * waveI[ph] >> 9;
+        out[i].q = sig[i] * waveQ[ph] >> 9;
+        if (++ph == CRT_CC_SAMPLES) {
+            ph = 0;
+        }
+#endif
+    }
+    eq_block(eq, out, L, R);
+    for (i = L; i < R; i++) {
+        out[i].y <<= 4;
+        out[i].i >>= 3;
+        out[i].q >>= 3;
+    }
+}
+
+/* the wave tables of a line in the order eq_line() uses them */
+static void
+line_waves(struct CRT_LINE *cl, int *waveI, int *waveQ)
+{
+#if (CRT_CC_SAMPLES == 4)
+    int i;
+    
+    for (i = 0; i < CRT_CC_SAMPLES; i++) {
+        waveI[i] = cl->wave[(i + 0) & 3];
+        waveQ[i] = cl->wave[(i + 3) & 3];
+    }
+#else
+    memcpy(waveI, cl->waveI, sizeof(int) * CRT_CC_SAMPLES);
+    memcpy(waveQ, cl->waveQ, sizeof(int) * CRT_CC_SAMPLES);
+#endif
+}
+
+/* output pixels are converted in chunks of this many at a time */
+#define CHUNK 64
+
+/* resample a decoded scan line and convert it to packed 0xRRGGBB pixels.
+ * written without branches and in a separate pass from storing the pixels
+ * so the compiler is free to vectorize it
+ */
+static void
+yiq2rgb(struct CRT_YIQ *out, unsigned pos, int dx, int n, int contrast,
+        int *rgb)
+{
+    int k;
+
+    for (k = 0; k < n; k++) {
+        struct CRT_YIQ *yiqA, *yiqB;
+        int y, i, q;
+        int r, g, b;
+        int L, R;
+        
+        R = pos & 0xfff;
+        L = 0xfff - R;
+        yiqA = out + (pos >> 12);
+        yiqB = yiqA + 1;
+        pos += dx;
+        
+        /* interpolate between samples if needed */
+        y = ((yiqA->y * L) >>  2) + ((yiqB->y * R) >>  2);
+        i = ((yiqA->i * L) >> 14) + ((yiqB->i * R) >> 14);
+        q = ((yiqA->q * L) >> 14) + ((yiqB->q * R) >> 14);
+        
+        /* YIQ to RGB */
+        r = (((y + 3879 * i + 2556 * q) >> 12) * contrast) >> 8;
+        g = (((y - 1126 * i - 2605 * q) >> 12) * contrast) >> 8;
+        b = (((y - 4530 * i + 7021 * q) >> 12) * contrast) >> 8;
+        
+        r = (r < 0) ? 0 : (r > 255) ? 255 : r;
+        g = (g < 0) ? 0 : (g > 255) ? 255 : g;
+        b = (b < 0) ? 0 : (b > 255) ? 255 : b;
+        
+        rgb[k] = (r << 16 | g << 8 | b);
+    }
+}
+
+/* store packed 0xRRGGBB pixels in the output image, one of these gets
+ * generated for each pixel format so the loop doesn't have to check the
+ * format for every pixel
+ *   bpp     - bytes per pixel
+ *   r, g, b - byte offset of each channel within a pixel
+ */
+#define DEFINE_STORE(name, bpp, r, g, b)                                       \
+static void                                                                    \
+name(unsigned char *c, int *rgb, int n)                                        \
+{                                                                              \
+    int k;                                                                     \
+                                                                               \
+    for (k = 0; k < n; k++, c += (bpp)) {                                      \
+        c[r] = rgb[k] >> 16 & 0xff;                                            \
+        c[g] = rgb[k] >>  8 & 0xff;                                            \
+        c[b] = rgb[k] >>  0 & 0xff;                                            \
+    }                                                                          \
+}
+
+DEFINE_STORE(store_rgb,  3, 0, 1, 2)
+DEFINE_STORE(store_bgr,  3, 2, 1, 0)
+DEFINE_STORE(store_argb, 4, 1, 2, 3)
+DEFINE_STORE(store_rgba, 4, 0, 1, 2)
+DEFINE_STORE(store_abgr, 4, 3, 2, 1)
+DEFINE_STORE(store_bgra, 4, 2, 1, 0)
+
+/* indexed by CRT_PIX_FORMAT_ */
+static void (*store_fmt[])(unsigned char *, int *, int) = {
+    store_rgb,
+    store_bgr,
+    store_argb,
+    store_rgba,
+    store_abgr,
+    store_bgra
+};
+
+/* blending and phosphor fading are done on the stored pixels, 4 bytes at a
+ * time in one unsigned int with two bytes per multiply. they work on any
+ * pixel format since every channel byte is treated the same, the alpha
+ * bytes (amask) are left alone like the stores do.
+ *   keep - fraction of the old pixel that is kept, 0 - 256
+ */
+#define SCALE4(w, d) ((((w) & 0x00ff00ffU) * (d) >> 8 & 0x00ff00ffU) |       \
+                      (((w) >> 8 & 0x00ff00ffU) * (d) & 0xff00ff00U))
+
+/* alpha byte of a format in the layout of an unsigned int read from memory */
+static unsigned
+alpha_mask(int format)
+{
+    unsigned char m[4];
+    unsigned mask;
+    int r, g, b;
+    
+    memset(m, 0, sizeof(m));
+    if (crt_offsets4fmt(format, &r, &g, &b) == 4) {
+        m[6 - r - g - b] = 0xff;
+    }
+    memcpy(&mask, m, sizeof(mask));
+    return mask;
+}
+
+/* blend n bytes of new pixels px onto c */
+static void
+blend_run(unsigned char *c, const unsigned char *px, int n, int keep,
+          unsigned amask)
+{
+    unsigned a, b, o;
+    int i;
+    
+    for (i = 0; i + 4 <= n; i += 4) {
+        memcpy(&a, c + i, 4);
+        memcpy(&b, px + i, 4);
+        o = SCALE4(a, keep) + SCALE4(b, 256 - keep);
+        o = (o & ~amask) | (a & amask);
+        memcpy(c + i, &o, 4);
+    }
+    /* only 3 byte formats have leftovers, they don't have alpha */
+    for (; i < n; i++) {
+        c[i] = ((c[i] * keep) >> 8) + ((px[i] * (256 - keep)) >> 8);
+    }
+}
+
+/* fade n bytes of pixels c */
+static void
+fade_run(unsigned char *c, long n, int keep, unsigned amask)
+{
+    unsigned a, o;
+    long i;
+    
+    for (i = 0; i + 4 <= n; i += 4) {
+        memcpy(&a, c + i, 4);
+        o = SCALE4(a, keep);
+        o = (o & ~amask) | (a & amask);
+        memcpy(c + i, &o, 4);
+    }
+    for (; i < n; i++) {
+        c[i] = (c[i] * keep) >> 8;
+    }
+}
 
 /*****************************************************************************/
 /***************************** PUBLIC FUNCTIONS ******************************/
@@ -247,6 +658,26 @@ crt_resize(struct CRT *v, int w, int h, int f, unsigned char *out)
     v->out = out;
 }
 
+extern void
+crt_set_buffers(struct CRT *v, signed char *analog, signed char *inp)
+{
+    v->analog = analog;
+    v->inp = inp;
+    /* nothing is known about what is in them */
+    memset(v->changed, 1, sizeof(v->changed));
+    v->dd_valid = 0;
+    v->fld_valid = 0;
+}
+
+extern void
+crt_set_targets(struct CRT *v, struct CRT_TARGET *t, int n)
+{
+    v->targets = t;
+    v->ntargets = (t == NULL) ? 0 : n;
+    /* they don't hold the last field yet */
+    v->dd_valid = 0;
+}
+
 extern void
 crt_reset(struct CRT *v)
 {
@@ -264,9 +695,16 @@ extern void
 crt_init(struct CRT *v, int w, int h, int f, unsigned char *out)
 {
     memset(v, 0, sizeof(struct CRT));
+#if CRT_OWN_BUFFERS && CRT_COMPACT
+    crt_set_buffers(v, v->analog_buf, NULL);
+#elif CRT_OWN_BUFFERS
+    crt_set_buffers(v, v->analog_buf, v->inp_buf);
+#endif
     crt_resize(v, w, h, f, out);
     crt_reset(v);
+    v->persistence = 128;
     v->rn = 194;
+    memset(v->changed, 1, sizeof(v->changed));
     
     /* kilohertz to line sample conversion */
 #define kHz2L(kHz) (CRT_HRES * (kHz * 100) / L_FREQ)
@@ -275,49 +713,113 @@ crt_init(struct CRT *v, int w, int h, int f, unsigned char *out)
      * if you change the EQ_P define, you'll need to update these gains too
      */
 #if (CRT_CC_SAMPLES == 4)
-    init_eq(&eqY, kHz2L(1500), kHz2L(3000), CRT_HRES, 65536, 8192, 9175);  
-    init_eq(&eqI, kHz2L(80),   kHz2L(1150), CRT_HRES, 65536, 65536, 1311);
-    init_eq(&eqQ, kHz2L(80),   kHz2L(1000), CRT_HRES, 65536, 65536, 0);
+    init_eq(&v->eqY, kHz2L(1500), kHz2L(3000), CRT_HRES, 65536, 8192, 9175);  
+    init_eq(&v->eqI, kHz2L(80),   kHz2L(1150), CRT_HRES, 65536, 65536, 1311);
+    init_eq(&v->eqQ, kHz2L(80),   kHz2L(1000), CRT_HRES, 65536, 65536, 0);
 #elif (CRT_CC_SAMPLES == 5)
-    init_eq(&eqY, kHz2L(1500), kHz2L(3000), CRT_HRES, 65536, 12192, 7775);
-    init_eq(&eqI, kHz2L(80),   kHz2L(1150), CRT_HRES, 65536, 65536, 1311);
-    init_eq(&eqQ, kHz2L(80),   kHz2L(1000), CRT_HRES, 65536, 65536, 0);
+    init_eq(&v->eqY, kHz2L(1500), kHz2L(3000), CRT_HRES, 65536, 12192, 7775);
+    init_eq(&v->eqI, kHz2L(80),   kHz2L(1150), CRT_HRES, 65536, 65536, 1311);
+    init_eq(&v->eqQ, kHz2L(80),   kHz2L(1000), CRT_HRES, 65536, 65536, 0);
 #else
 #error "NTSC-CRT currently only supports 4 or 5 samples per chroma period."
 #endif
 
 }
 
-extern void
-crt_demodulate(struct CRT *v, int noise)
+#if CRT_COMPACT
+#if ((CRT_SYSTEM == CRT_SYSTEM_NTSCVHS) && CRT_VHS_NOISE)
+#define NOISY_FIELD(v) 1 /* the tracking band is always there */
+#else
+#define NOISY_FIELD(v) ((v)->sy_noise != 0)
+#endif
+
+/* samples [pos, pos + n) of the field with the noise of the field */
+static void
+noisy_samples(struct CRT *v, signed char *dst, int pos, int n)
+{
+    unsigned a, c;
+    
+    if (n <= 0) {
+        return;
+    }
+    if (v->sy_noise) {
+        /* same numbers add_noise() would have given these samples */
+        lcg_jump(pos, &a, &c);
+        noise_samples(dst, v->analog + pos, n, v->sy_noise,
+                      (unsigned) v->sy_rn * a + c);
+    } else {
+        memcpy(dst, v->analog + pos, n);
+    }
+#if ((CRT_SYSTEM == CRT_SYSTEM_NTSCVHS) && CRT_VHS_NOISE)
+    tracking_band(v, dst, pos, pos, pos + n);
+#endif
+}
+#endif
+
+/* the n samples of the field v->sig starting at pos. a line that starts
+ * near the end of the field runs into the start of the next one, so those
+ * get wrapped around into tmp instead of reading past the end of the signal
+ */
+static signed char *
+field_samples(struct CRT *v, int pos, int n, signed char *tmp)
+{
+    int k;
+    
+#if CRT_COMPACT
+    if (NOISY_FIELD(v)) {
+        k = (pos + n <= CRT_INPUT_SIZE) ? n : (CRT_INPUT_SIZE - pos);
+        noisy_samples(v, tmp, pos, k);
+        noisy_samples(v, tmp + k, 0, n - k);
+        return tmp;
+    }
+#endif
+    if (pos + n <= CRT_INPUT_SIZE) {
+        return v->sig + pos;
+    }
+    k = CRT_INPUT_SIZE - pos;
+    memcpy(tmp, v->sig + pos, k);
+    memcpy(tmp + k, v->sig, n - k);
+    return tmp;
+}
+
+/* first part of the sync pass, everything that is done once per field:
+ * the noise, the hue and looking for vertical sync
+ */
+static void
+sync_field(struct CRT *v, int noise)
 {
-    /* made static so all this data does not go on the stack */
-    static struct {
-        int y, i, q;
-    } out[AV_LEN + 1], *yiqA, *yiqB;
     int i, j, line, rn;
     signed char *sig;
+    signed char tmp[CRT_HRES];
     int s = 0;
-    int field, ratio;
-    int *ccr; /* color carrier signal */
+    int field;
     int huesn, huecs;
-    int xnudge = -3, ynudge = 3;
-    int bright = v->brightness - (BLACK_LEVEL + v->black_point);
-    int bpp, pitch;
-#if CRT_DO_BLOOM
-    int prev_e; /* filtered beam energy per scan line */
-    int max_e; /* approx maximum energy in a scan line */
+#if CRT_DO_STATS
+    long st;
 #endif
     
-    bpp = crt_bpp4fmt(v->out_format);
-    if (bpp == 0) {
-        return;
-    }
-    pitch = v->outw * bpp;
+    CRT_STAT_BEG(st);
+    CRT_STAT_ADD(v, synced, 1);
     
     crt_sincos14(&huesn, &huecs, ((v->hue % 360) + 33) * 8192 / 180);
     huesn >>= 11; /* make 4-bit */
     huecs >>= 11;
+#if (CRT_CC_SAMPLES == 5)
+    if (!v->hue_valid || v->hue_tab != v->hue) {
+        /* the hue adjustment angle for every chroma sample */
+        int ang = (v->hue % 360);
+        
+        for (i = 0; i < CRT_CC_SAMPLES; i++) {
+            crt_sincos14(&v->hue_sn[0][i], &v->hue_cs[0][i], ang * 8192 / 180);
+            /* Q is offset by 90 */
+            crt_sincos14(&v->hue_sn[1][i], &v->hue_cs[1][i],
+                         (ang + 90) * 8192 / 180);
+            ang += (360 / CRT_CC_SAMPLES);
+        }
+        v->hue_tab = v->hue;
+        v->hue_valid = 1;
+    }
+#endif
 
     rn = v->rn;
 #if !CRT_DO_VSYNC
@@ -339,32 +841,39 @@ found_field:
     /* if vsync signal was in second half of line, odd field */
     field = (j > (CRT_HRES / 2));
     v->vsync = -3;
+    CRT_STAT_LAP(v, vsync, st);
 #endif
-#if ((CRT_SYSTEM == CRT_SYSTEM_NTSCVHS) && CRT_VHS_NOISE)
-    line = ((rand() % 8) - 4) + 14;
+#if CRT_COMPACT
+    /* there is no inp, field_samples() adds the noise to what gets read */
+    v->sy_noise = noise;
+    v->sy_rn = rn;
 #endif
-    for (i = 0; i < CRT_INPUT_SIZE; i++) {
-        int nn = noise;
+    if (noise == 0 || CRT_COMPACT) {
+        unsigned a, c;
+        
+        /* the modulators never go outside of -127 to 127 so the clean
+         * signal can be read straight from analog, the noise generator
+         * still gets advanced so the next noisy field is the same
+         */
+        lcg_jump(CRT_INPUT_SIZE, &a, &c);
+        rn = (int) ((unsigned) rn * a + c);
+        v->sig = v->analog;
+    } else {
+        add_noise(v->inp, v->analog, noise, &rn);
+        v->sig = v->inp;
+    }
 #if ((CRT_SYSTEM == CRT_SYSTEM_NTSCVHS) && CRT_VHS_NOISE)
-        rn = rand();
-        if (i > (CRT_INPUT_SIZE - CRT_HRES * (16 + ((rand() % 20) - 10))) &&
-            i < (CRT_INPUT_SIZE - CRT_HRES * (5 + ((rand() % 8) - 4)))) {
-            int ln, sn, cs;
-            
-            ln = (i * line) / CRT_HRES;
-            crt_sincos14(&sn, &cs, ln * 8192 / 180);
-            nn = cs >> 8;
-        }
-#else
-        rn = (214019 * rn + 140327895);
-#endif
-        /* signal + noise */
-        s = v->analog[i] + (((((rn >> 16) & 0xff) - 0x7f) * nn) >> 8);
-        if (s >  127) { s =  127; }
-        if (s < -127) { s = -127; }
-        v->inp[i] = s;
+    tracking_setup(v, &rn);
+#if !CRT_COMPACT
+    if (v->sig == v->analog) {
+        memcpy(v->inp, v->analog, CRT_INPUT_SIZE);
+        v->sig = v->inp;
     }
+    tracking_band(v, v->inp, 0, 0, CRT_INPUT_SIZE);
+#endif
+#endif
     v->rn = rn;
+    CRT_STAT_LAP(v, noise, st);
 
 #if CRT_DO_VSYNC
     /* Look for vertical sync.
@@ -378,7 +887,7 @@ found_field:
      */
     for (i = -CRT_VSYNC_WINDOW; i < CRT_VSYNC_WINDOW; i++) {
         line = POSMOD(v->vsync + i, CRT_VRES);
-        sig = v->inp + line * CRT_HRES;
+        sig = field_samples(v, line * CRT_HRES, CRT_HRES, tmp);
         s = 0;
         for (j = 0; j < CRT_HRES; j++) {
             s += sig[j];
@@ -394,48 +903,61 @@ vsync_found:
     v->vsync = line; /* vsync found (or gave up) at this line */
     /* if vsync signal was in second half of line, odd field */
     field = (j > (CRT_HRES / 2));
+    CRT_STAT_ADD(v, vsync_iter, (i + CRT_VSYNC_WINDOW) * CRT_HRES + j);
+    CRT_STAT_ADD(v, vsync_lost, (i == CRT_VSYNC_WINDOW));
 #endif
+    v->field = field;
+    CRT_STAT_LAP(v, vsync, st);
 
+    v->sy_huesn = huesn;
+    v->sy_huecs = huecs;
 #if CRT_DO_BLOOM
-    max_e = (128 + (noise / 2)) * AV_LEN;
-    prev_e = (16384 / 8);
+    v->sy_max_e = (128 + (noise / 2)) * AV_LEN;
+    v->sy_prev_e = (16384 / 8);
 #endif
-    /* ratio of output height to active video lines in the signal */
-    ratio = (v->outh << 16) / CRT_LINES;
-    ratio = (ratio + 32768) >> 16;
-    
-    field = (field * (ratio / 2));
+}
 
-    for (line = CRT_TOP; line < CRT_BOT; line++) {
-        unsigned pos, ln, scanR;
-        int scanL, dx;
-        int L, R;
-        unsigned char *cL, *cR;
+/* rest of the sync pass, horizontal sync and the color burst of active
+ * lines [first, last), they have to be done in order
+ */
+static void
+sync_lines(struct CRT *v, int first, int last)
+{
+    int i, line;
 #if (CRT_CC_SAMPLES == 4)
-        int wave[CRT_CC_SAMPLES];
+    int huesn = v->sy_huesn, huecs = v->sy_huecs;
 #else
-        int waveI[CRT_CC_SAMPLES];
-        int waveQ[CRT_CC_SAMPLES];
+    int j;
+#endif
+    signed char *sig;
+    signed char tmp[CRT_HRES];
+    int s = 0;
+    int *ccr; /* color carrier signal */
+    int xnudge = -3, ynudge = 3;
+#if CRT_DO_BLOOM
+    int prev_e = v->sy_prev_e; /* filtered beam energy per scan line */
+    int max_e = v->sy_max_e; /* approx maximum energy in a scan line */
 #endif
+#if CRT_DO_STATS
+    long st;
+#endif
+    
+    CRT_STAT_BEG(st);
+    for (line = CRT_TOP + first; line < CRT_TOP + last; line++) {
+        struct CRT_LINE *cl = &v->lines[line - CRT_TOP];
+        unsigned ln;
         int dci, dcq; /* decoded I, Q */
         int xpos, ypos;
-        int beg, end;
         int phasealign;
-#if CRT_DO_BLOOM
-        int line_w;
-#endif
   
-        beg = (line - CRT_TOP + 0) * (v->outh + v->v_fac) / CRT_LINES + field;
-        end = (line - CRT_TOP + 1) * (v->outh + v->v_fac) / CRT_LINES + field;
-
-        if (beg >= v->outh) { continue; }
-        if (end > v->outh) { end = v->outh; }
+        if (line_to_row(v, line, 0) >= v->outh) { continue; }
 
         /* Look for horizontal sync.
          * See comment above regarding vertical sync.
          */
         ln = (POSMOD(line + v->vsync, CRT_VRES)) * CRT_HRES;
-        sig = v->inp + ln + v->hsync;
+        sig = field_samples(v, ln + v->hsync,
+                            SYNC_BEG + CRT_HSYNC_WINDOW, tmp);
         s = 0;
         for (i = -CRT_HSYNC_WINDOW; i < CRT_HSYNC_WINDOW; i++) {
             s += sig[SYNC_BEG + i];
@@ -443,28 +965,45 @@ vsync_found:
                 break;
             }
         }
+        CRT_STAT_ADD(v, hsync_iter, i + CRT_HSYNC_WINDOW);
+        CRT_STAT_ADD(v, hsync_lost, (i == CRT_HSYNC_WINDOW));
 #if CRT_DO_HSYNC
         v->hsync = POSMOD(i + v->hsync, CRT_HRES);
 #else
         v->hsync = 0;
 #endif
+        CRT_STAT_LAP(v, hsync, st);
         
         xpos = POSMOD(AV_BEG + v->hsync + xnudge, CRT_HRES);
         ypos = POSMOD(line + v->vsync + ynudge, CRT_VRES);
-        pos = xpos + ypos * CRT_HRES;
+        cl->pos = xpos + ypos * CRT_HRES;
         
         ccr = v->ccf[ypos % CRT_CC_VPER];
 #if (CRT_CC_SAMPLES == 4)
-        sig = v->inp + ln + (v->hsync & ~3); /* faster */
+        i = ln + (v->hsync & ~3); /* faster */
 #else
-        sig = v->inp + ln + (v->hsync - (v->hsync % CRT_CC_SAMPLES));
+        i = ln + (v->hsync - (v->hsync % CRT_CC_SAMPLES));
 #endif
+        sig = field_samples(v, i, CB_BEG + (CB_CYCLES * CRT_CB_FREQ), tmp);
+#if (CRT_CC_SAMPLES == 4)
         for (i = CB_BEG; i < CB_BEG + (CB_CYCLES * CRT_CB_FREQ); i++) {
             int p, n;
-            p = ccr[i % CRT_CC_SAMPLES] * 127 / 128; /* fraction of the previous */
+            p = ccr[i & 3] * 127 / 128; /* fraction of the previous */
             n = sig[i];                 /* mixed with the new sample */
-            ccr[i % CRT_CC_SAMPLES] = p + n;
+            ccr[i & 3] = p + n;
+        }
+#else
+        j = CB_BEG % CRT_CC_SAMPLES;
+        for (i = CB_BEG; i < CB_BEG + (CB_CYCLES * CRT_CB_FREQ); i++) {
+            int p, n;
+            p = ccr[j] * 127 / 128; /* fraction of the previous */
+            n = sig[i];             /* mixed with the new sample */
+            ccr[j] = p + n;
+            if (++j == CRT_CC_SAMPLES) {
+                j = 0;
+            }
         }
+#endif
 
         phasealign = POSMOD(v->hsync, CRT_CC_SAMPLES);
         
@@ -473,176 +1012,629 @@ vsync_found:
         dci = ccr[(phasealign + 1) & 3] - ccr[(phasealign + 3) & 3];
         dcq = ccr[(phasealign + 2) & 3] - ccr[(phasealign + 0) & 3];
 
-        wave[0] = ((dci * huecs - dcq * huesn) >> 4) * v->saturation;
-        wave[1] = ((dcq * huecs + dci * huesn) >> 4) * v->saturation;
-        wave[2] = -wave[0];
-        wave[3] = -wave[1];
+        cl->wave[0] = ((dci * huecs - dcq * huesn) >> 4) * v->saturation;
+        cl->wave[1] = ((dcq * huecs + dci * huesn) >> 4) * v->saturation;
+        cl->wave[2] = -cl->wave[0];
+        cl->wave[3] = -cl->wave[1];
 #elif (CRT_CC_SAMPLES == 5)
         {
             int dciA, dciB;
             int dcqA, dcqB;
-            int ang = (v->hue % 360);
             int off180 = CRT_CC_SAMPLES / 2;
             int off90 = CRT_CC_SAMPLES / 4;
             int peakA = phasealign + off90;
             int peakB = phasealign + 0;
             dciA = dciB = dcqA = dcqB = 0;
             /* amplitude of carrier = saturation, phase difference = hue */
-            dciA = ccr[(peakA) % CRT_CC_SAMPLES];
+            dciA = ccr[CC_WRAP(peakA)];
             /* average */
-            dciB = (ccr[(peakA + off180) % CRT_CC_SAMPLES]
-                  + ccr[(peakA + off180 + 1) % CRT_CC_SAMPLES]) / 2;
-            dcqA = ccr[(peakB + off180) % CRT_CC_SAMPLES];
-            dcqB = ccr[(peakB) % CRT_CC_SAMPLES];
+            dciB = (ccr[CC_WRAP(peakA + off180)]
+                  + ccr[CC_WRAP(peakA + off180 + 1)]) / 2;
+            dcqA = ccr[CC_WRAP(peakB + off180)];
+            dcqB = ccr[CC_WRAP(peakB)];
             dci = dciA - dciB;
             dcq = dcqA - dcqB;
             /* create wave tables and rotate them by the hue adjustment angle */
             for (i = 0; i < CRT_CC_SAMPLES; i++) {
-                int sn, cs;
-                crt_sincos14(&sn, &cs, ang * 8192 / 180);
-                waveI[i] = ((dci * cs + dcq * sn) >> 15) * v->saturation;
-                /* Q is offset by 90 */
-                crt_sincos14(&sn, &cs, (ang + 90) * 8192 / 180);
-                waveQ[i] = ((dci * cs + dcq * sn) >> 15) * v->saturation;
-                ang += (360 / CRT_CC_SAMPLES);
+                cl->waveI[i] = ((dci * v->hue_cs[0][i] +
+                                 dcq * v->hue_sn[0][i]) >> 15) * v->saturation;
+                cl->waveQ[i] = ((dci * v->hue_cs[1][i] +
+                                 dcq * v->hue_sn[1][i]) >> 15) * v->saturation;
             }
         }
 #endif
-        sig = v->inp + pos;
 #if CRT_DO_BLOOM
+        sig = field_samples(v, cl->pos, AV_LEN, tmp);
         s = 0;
         for (i = 0; i < AV_LEN; i++) {
             s += sig[i]; /* sum up the scan line */
         }
         /* bloom emulation */
         prev_e = (prev_e * 123 / 128) + ((((max_e >> 1) - s) << 10) / max_e);
-        line_w = (AV_LEN * 112 / 128) + (prev_e >> 9);
+        cl->line_w = (AV_LEN * 112 / 128) + (prev_e >> 9);
+#endif
+        CRT_STAT_LAP(v, burst, st);
+    }
+#if CRT_DO_BLOOM
+    v->sy_prev_e = prev_e;
+#endif
+}
+
+extern void
+crt_demodulate_sync(struct CRT *v, int noise)
+{
+    if (crt_bpp4fmt(v->out_format) == 0) {
+        return;
+    }
+    sync_field(v, noise);
+    sync_lines(v, 0, CRT_LINES);
+}
+
+/* a still image blended onto the output over and over converges after at
+ * most this many fields since every blend halves the difference
+ */
+#define STILL_BLENDS     8
+/* max number of sync passes crt_demodulate_still() waits for it to settle */
+#define STILL_SYNC_TRIES 4
+
+/* an image demodulate_lines() draws into */
+struct DRAW {
+    struct CRT_TARGET t;
+    int bpp, pitch;
+    unsigned amask;
+    void (*store)(unsigned char *, int *, int);
+};
+
+/* the output image and the targets, returns how many can be drawn into */
+static int
+draw_setup(struct CRT *v, struct DRAW *d)
+{
+    int i, n = 0;
+    
+    for (i = -1; i < v->ntargets && i < CRT_MAX_TARGETS; i++) {
+        struct DRAW *o = &d[n];
+        
+        if (i < 0) {
+            o->t.w = v->outw;
+            o->t.h = v->outh;
+            o->t.format = v->out_format;
+            o->t.pitch = 0;
+            o->t.out = v->out;
+        } else {
+            o->t = v->targets[i];
+        }
+        o->bpp = crt_bpp4fmt(o->t.format);
+        if (o->bpp == 0 || o->t.w <= 0 || o->t.out == NULL) {
+            continue;
+        }
+        o->pitch = o->t.pitch ? o->t.pitch : o->t.w * o->bpp;
+        o->store = store_fmt[o->t.format];
+        o->amask = alpha_mask(o->t.format);
+        n++;
+    }
+    return n;
+}
+
+/* output rows [beg, end) of a line in d, returns 0 if it has none */
+static int
+draw_rows(struct CRT *v, struct DRAW *d, int line, int *beg, int *end)
+{
+    *beg = line_to_row_h(v, d->t.h, line, 0);
+    *end = line_to_row_h(v, d->t.h, line, 1);
+    
+    if (*beg >= d->t.h) { return 0; }
+    if (*end > d->t.h) { *end = d->t.h; }
+    if (v->field_only) {
+        /* compact rows, stretching is up to the caller */
+        *beg = line - CRT_TOP;
+        *end = *beg + 1;
+    }
+    return 1;
+}
+
+/* resample the decoded line out onto row beg of d, the line covers
+ * [scanL, scanR) of it in 20.12 fixed point, dx per output pixel
+ */
+static void
+draw_line(struct CRT *v, struct DRAW *d, int beg, struct CRT_YIQ *out,
+          int scanL, unsigned scanR, int dx, int passes, unsigned char *px)
+{
+    unsigned char *cL;
+    unsigned pos;
+    int x, n;
+    
+    cL = d->t.out + (beg * d->pitch);
+
+    /* number of output pixels on this scan line */
+    n = 0;
+    if ((unsigned) scanL < scanR) {
+        n = d->t.w;
+        if (dx > 0 && (int) ((scanR - scanL + dx - 1) / dx) < n) {
+            n = (scanR - scanL + dx - 1) / dx;
+        }
+    }
+    pos = scanL;
+    for (x = 0; x < n; x += CHUNK) {
+        int rgb[CHUNK];
+        int len = n - x;
+        int p;
+        
+        if (len > CHUNK) {
+            len = CHUNK;
+        }
+        yiq2rgb(out, pos, dx, len, v->contrast, rgb);
+        pos += len * dx;
+        
+        if (v->blend) {
+            d->store(px, rgb, len);
+            for (p = 0; p < passes; p++) {
+                blend_run(cL, px, len * d->bpp, v->persistence, d->amask);
+            }
+        } else {
+            d->store(cL, rgb, len);
+        }
+        cL += len * d->bpp;
+    }
+}
+
+/* decode lines [first, last), storing every pixel 'passes' times */
+static void
+demodulate_lines(struct CRT *v, struct CRT_YIQ *out, int first, int last,
+                 int passes)
+{
+    struct EQF eq[3];
+    struct DRAW draw[1 + CRT_MAX_TARGETS];
+    unsigned char px[CHUNK * 4]; /* new pixels that get blended */
+    int line, ndraw;
+    signed char *sig;
+    signed char tmp[AV_LEN];
+    int s = 0;
+    int bright = v->brightness - (BLACK_LEVEL + v->black_point);
+#if CRT_DO_STATS
+    long st;
+#endif
+    
+    ndraw = draw_setup(v, draw);
+    if (ndraw == 0) {
+        return;
+    }
+    memset(px, 0, sizeof(px)); /* alpha bytes are never stored */
+    
+    eq[0] = v->eqY;
+    eq[1] = v->eqI;
+    eq[2] = v->eqQ;
+    
+    if (first < 0) { first = 0; }
+    if (last > CRT_LINES) { last = CRT_LINES; }
+    CRT_STAT_BEG(st);
+
+    for (line = CRT_TOP + first; line < CRT_TOP + last; line++) {
+        struct CRT_LINE *cl = &v->lines[line - CRT_TOP];
+        unsigned scanR;
+        int scanL, line_w;
+        int L, R;
+        int i, beg, end;
+        int waveI[CRT_CC_SAMPLES];
+        int waveQ[CRT_CC_SAMPLES];
+  
+        /* the sync pass skips the lines that are not in the output image */
+        if (line_to_row(v, line, 0) >= v->outh) { continue; }
+
+#if CRT_DO_BLOOM
+        line_w = cl->line_w;
 
-        dx = (line_w << 12) / v->outw;
         scanL = ((AV_LEN / 2) - (line_w >> 1) + 8) << 12;
         scanR = (AV_LEN - 1) << 12;
         
         L = (scanL >> 12);
         R = (scanR >> 12);
 #else
-        dx = ((AV_LEN - 1) << 12) / v->outw;
+        line_w = AV_LEN - 1;
         scanL = 0;
         scanR = (AV_LEN - 1) << 12;
         L = 0;
         R = AV_LEN;
 #endif
-        reset_eq(&eqY);
-        reset_eq(&eqI);
-        reset_eq(&eqQ);
+        sig = field_samples(v, cl->pos, AV_LEN, tmp);
+        /* local copies, the compiler can't tell they don't alias the output */
+        line_waves(cl, waveI, waveQ);
+        eq_line(eq, sig, waveI, waveQ, bright, out, L, R);
+        CRT_STAT_LAP(v, eq, st);
+        CRT_STAT_ADD(v, lines, 1);
+
+        /* the same decoded line goes into every image */
+        for (i = 0; i < ndraw; i++) {
+            if (draw_rows(v, &draw[i], line, &beg, &end)) {
+                draw_line(v, &draw[i], beg, out, scanL, scanR,
+                          (line_w << 12) / draw[i].t.w, passes, px);
+            }
+        }
+        CRT_STAT_LAP(v, rgb, st);
         
-#if (CRT_CC_SAMPLES == 4)
-        for (i = L; i < R; i++) {
-            out[i].y = eqf(&eqY, sig[i] + bright) << 4;
-            out[i].i = eqf(&eqI, sig[i] * wave[(i + 0) & 3] >> 9) >> 3;
-            out[i].q = eqf(&eqQ, sig[i] * wave[(i + 3) & 3] >> 9) >> 3;
+        /* duplicate extra lines */
+        for (i = 0; i < ndraw && !v->field_only; i++) {
+            struct DRAW *d = &draw[i];
+            
+            if (!draw_rows(v, d, line, &beg, &end)) {
+                continue;
+            }
+            for (s = beg + 1; s < (end - v->scanlines); s++) {
+                memcpy(d->t.out + s * d->pitch, d->t.out + (s - 1) * d->pitch,
+                       d->t.w * d->bpp);
+            }
         }
-#else
-        for (i = L; i < R; i++) {
-            out[i].y = eqf(&eqY, sig[i] + bright) << 4;
-            out[i].i = eqf(&eqI, sig[i] * waveI[i % CRT_CC_SAMPLES] >> 9) >> 3;
-            out[i].q = eqf(&eqQ, sig[i] * waveQ[i % CRT_CC_SAMPLES] >> 9) >> 3;
-        } 
-#endif
+        CRT_STAT_LAP(v, dup, st);
+    }
+}
 
-        cL = v->out + (beg * pitch);
-        cR = cL + pitch;
+extern void
+crt_demodulate_lines(struct CRT *v, struct CRT_YIQ *out, int first, int last)
+{
+    demodulate_lines(v, out, first, last, 1);
+}
 
-        for (pos = scanL; pos < scanR && cL < cR; pos += dx) {
-            int y, i, q;
-            int r, g, b;
-            int aa, bb;
+extern void
+crt_demodulate(struct CRT *v, int noise)
+{
+    crt_demodulate_sync(v, noise);
+    crt_demodulate_lines(v, v->yiq, 0, CRT_LINES);
+}
 
-            R = pos & 0xfff;
-            L = 0xfff - R;
-            s = pos >> 12;
-            
-            yiqA = out + s;
-            yiqB = out + s + 1;
-            
-            /* interpolate between samples if needed */
-            y = ((yiqA->y * L) >>  2) + ((yiqB->y * R) >>  2);
-            i = ((yiqA->i * L) >> 14) + ((yiqB->i * R) >> 14);
-            q = ((yiqA->q * L) >> 14) + ((yiqB->q * R) >> 14);
-            
-            /* YIQ to RGB */
-            r = (((y + 3879 * i + 2556 * q) >> 12) * v->contrast) >> 8;
-            g = (((y - 1126 * i - 2605 * q) >> 12) * v->contrast) >> 8;
-            b = (((y - 4530 * i + 7021 * q) >> 12) * v->contrast) >> 8;
-          
-            if (r < 0) r = 0;
-            if (g < 0) g = 0;
-            if (b < 0) b = 0;
-            if (r > 255) r = 255;
-            if (g > 255) g = 255;
-            if (b > 255) b = 255;
-
-            if (v->blend) {
-                aa = (r << 16 | g << 8 | b);
-
-                switch (v->out_format) {
-                    case CRT_PIX_FORMAT_RGB:
-                    case CRT_PIX_FORMAT_RGBA:
-                        bb = cL[0] << 16 | cL[1] << 8 | cL[2];
-                        break;
-                    case CRT_PIX_FORMAT_BGR: 
-                    case CRT_PIX_FORMAT_BGRA:
-                        bb = cL[2] << 16 | cL[1] << 8 | cL[0];
-                        break;
-                    case CRT_PIX_FORMAT_ARGB:
-                        bb = cL[1] << 16 | cL[2] << 8 | cL[3];
-                        break;
-                    case CRT_PIX_FORMAT_ABGR:
-                        bb = cL[3] << 16 | cL[2] << 8 | cL[1];
-                        break;
-                    default:
-                        bb = 0;
-                        break;
-                }
-
-                /* blend with previous color there */
-                bb = (((aa & 0xfefeff) >> 1) + ((bb & 0xfefeff) >> 1));
-            } else {
-                bb = (r << 16 | g << 8 | b);
-            }
+extern void
+crt_demodulate_signal(struct CRT *v, const signed char *sig, int noise)
+{
+    signed char *analog = v->analog;
+    
+    /* the demodulator only reads analog, so just point it at sig */
+    v->analog = (signed char *) sig;
+    crt_demodulate(v, noise);
+    v->analog = analog;
+    /* the output is of a different signal now */
+    v->dd_valid = 0;
+}
+
+extern void
+crt_demodulate_still(struct CRT *v, int noise)
+{
+    int ccf[CRT_CC_VPER][CRT_CC_SAMPLES];
+    int i, hs, vs, rn;
+    
+    /* the sync search only moves a little every field, and without sync
+     * the field can't be decoded properly so let it settle first.
+     * only sync is meant to move, every pass gets the same noise and
+     * color carrier so the result doesn't depend on how many it took
+     */
+    rn = v->rn;
+    memcpy(ccf, v->ccf, sizeof(ccf));
+    for (i = 0; i < STILL_SYNC_TRIES; i++) {
+        hs = v->hsync;
+        vs = v->vsync;
+        v->rn = rn;
+        memcpy(v->ccf, ccf, sizeof(ccf));
+        crt_demodulate_sync(v, noise);
+        if (v->hsync == hs && v->vsync == vs) {
+            break;
+        }
+    }
+    /* the color carrier is already converged (see ccf in crt_modulate())
+     * so what's left is blending the same pixels until they stop changing
+     */
+    demodulate_lines(v, v->yiq, 0, CRT_LINES, v->blend ? STILL_BLENDS : 1);
+}
+
+extern void
+crt_demodulate_dirty(struct CRT *v, int noise)
+{
+    struct CRT_DD_KEY key;
+    int all, line, first, redo;
+    
+    memcpy(v->dd_lines, v->lines, sizeof(v->lines));
+    crt_demodulate_sync(v, noise);
 
-            switch (v->out_format) {
-                case CRT_PIX_FORMAT_RGB:
-                case CRT_PIX_FORMAT_RGBA:
-                    cL[0] = bb >> 16 & 0xff;
-                    cL[1] = bb >>  8 & 0xff;
-                    cL[2] = bb >>  0 & 0xff;
-                    break;
-                case CRT_PIX_FORMAT_BGR: 
-                case CRT_PIX_FORMAT_BGRA:
-                    cL[0] = bb >>  0 & 0xff;
-                    cL[1] = bb >>  8 & 0xff;
-                    cL[2] = bb >> 16 & 0xff;
-                    break;
-                case CRT_PIX_FORMAT_ARGB:
-                    cL[1] = bb >> 16 & 0xff;
-                    cL[2] = bb >>  8 & 0xff;
-                    cL[3] = bb >>  0 & 0xff;
-                    break;
-                case CRT_PIX_FORMAT_ABGR:
-                    cL[1] = bb >>  0 & 0xff;
-                    cL[2] = bb >>  8 & 0xff;
-                    cL[3] = bb >> 16 & 0xff;
-                    break;
-                default:
-                    break;
+    memset(&key, 0, sizeof(key));
+    key.outw = v->outw;
+    key.outh = v->outh;
+    key.out_format = v->out_format;
+    key.hue = v->hue;
+    key.brightness = v->brightness;
+    key.contrast = v->contrast;
+    key.saturation = v->saturation;
+    key.black_point = v->black_point;
+    key.scanlines = v->scanlines;
+    key.blend = v->blend;
+    key.field = v->field;
+    key.v_fac = v->v_fac;
+    key.field_only = v->field_only;
+    key.persistence = v->persistence;
+    /* the targets can be edited in place, so it is their contents */
+    key.ntargets = v->ntargets;
+    if (key.ntargets > CRT_MAX_TARGETS) {
+        key.ntargets = CRT_MAX_TARGETS;
+    }
+    if (key.ntargets > 0) {
+        memcpy(key.targets, v->targets,
+               sizeof(struct CRT_TARGET) * key.ntargets);
+    }
+    
+    all = !v->dd_valid || noise != 0 || v->dd_out != v->out ||
+          memcmp(&key, &v->dd_key, sizeof(key)) != 0;
+#if ((CRT_SYSTEM == CRT_SYSTEM_NTSCVHS) && CRT_VHS_NOISE)
+    all = 1; /* the tracking noise is different every field */
+#endif
+    v->dd_key = key;
+    v->dd_out = v->out;
+    v->dd_valid = 1;
+    
+    /* with blending a line has to be decoded until it converges */
+    redo = v->blend ? STILL_BLENDS : 1;
+    for (line = 0; line < CRT_LINES; line++) {
+        struct CRT_LINE *cl = &v->lines[line];
+        int a, b;
+        
+        /* analog lines this scan line reads from (see field_samples) */
+        a = cl->pos / CRT_HRES;
+        b = (cl->pos + AV_LEN) / CRT_HRES;
+        if (b >= CRT_VRES) {
+            b -= CRT_VRES;
+        }
+        if (all || v->changed[a] || v->changed[b] ||
+            memcmp(cl, &v->dd_lines[line], sizeof(struct CRT_LINE)) != 0) {
+            v->dd_redo[line] = redo;
+        }
+    }
+    memset(v->changed, 0, sizeof(v->changed));
+    
+    /* decode each run of lines that need it */
+    first = -1;
+    for (line = 0; line <= CRT_LINES; line++) {
+        if (line < CRT_LINES && v->dd_redo[line]) {
+            v->dd_redo[line]--;
+            if (first < 0) {
+                first = line;
             }
+        } else if (first >= 0) {
+            demodulate_lines(v, v->yiq, first, line, 1);
+            first = -1;
+        }
+    }
+}
 
-            cL += bpp;
+extern int
+crt_field_map(struct CRT *v, int *beg, int *end)
+{
+    int line, n = 0;
+    
+    for (line = CRT_TOP; line < CRT_BOT; line++) {
+        int b, e;
+        
+        b = line_to_row(v, line, 0);
+        if (b >= v->outh) {
+            break; /* so are all of the lines after it */
+        }
+        e = line_to_row(v, line, 1);
+        if (e > v->outh) {
+            e = v->outh;
         }
+        beg[n] = b;
+        end[n] = e;
+        n++;
+    }
+    return n;
+}
+
+extern void
+crt_fade(struct CRT *v, int keep)
+{
+    struct DRAW draw[CRT_MAX_TARGETS + 1];
+    int i, n, y, rows;
+    
+    n = draw_setup(v, draw);
+    for (i = 0; i < n; i++) {
+        struct DRAW *d = &draw[i];
+        long len = (long) d->t.w * d->bpp;
         
-        /* duplicate extra lines */
-        for (s = beg + 1; s < (end - v->scanlines); s++) {
-            memcpy(v->out + s * pitch, v->out + (s - 1) * pitch, pitch);
+        rows = v->field_only ? CRT_LINES : d->t.h;
+        if (d->pitch == len) {
+            fade_run(d->t.out, len * rows, keep, d->amask);
+            continue;
         }
+        for (y = 0; y < rows; y++) {
+            fade_run(d->t.out + (long) y * d->pitch, len, keep, d->amask);
+        }
+    }
+}
+
+/* makes inp[from, to) from analog the same way sync_field() did */
+static void
+refresh_input(struct CRT *v, struct CRT_STREAM *st, int from, int to)
+{
+    unsigned a, c;
+    
+    if (v->sig == v->analog || from >= to) {
+        return;
     }
+    if (st->noise) {
+        lcg_jump(from, &a, &c);
+        noise_samples(v->inp + from, v->analog + from, to - from, st->noise,
+                      (unsigned) st->rn * a + c);
+    } else {
+        memcpy(v->inp + from, v->analog + from, to - from);
+    }
+#if ((CRT_SYSTEM == CRT_SYSTEM_NTSCVHS) && CRT_VHS_NOISE)
+    tracking_band(v, v->inp, 0, from, to);
+#endif
+}
+
+/* the image row that line y of the image is modulated from */
+static int
+line_row(struct NTSC_SETTINGS *s, int y)
+{
+    int sy = s->rs_row[y];
+    
+#if (CRT_SYSTEM == CRT_SYSTEM_NTSC) || (CRT_SYSTEM == CRT_SYSTEM_PV1K) || \
+    (CRT_SYSTEM == CRT_SYSTEM_TEMP) || (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
+    /* the odd field starts half a line down */
+    sy += (s->field * s->h + s->rs_desth) / s->rs_desth / 2;
+#endif
+    return sy;
+}
+
+/* is analog line n done being modulated */
+static int
+line_ready(struct CRT_STREAM *st, int n)
+{
+    struct NTSC_SETTINGS *s = st->s;
+    int y;
+    
+    /* every system keeps the first line of the image in dl_key[1] */
+    y = POSMOD(n, CRT_VRES) - s->dl_key[1];
+    if (st->src >= s->h || y < 0 || y >= s->rs_desth) {
+        return 1; /* blanking, made by crt_stream_begin() */
+    }
+    return line_row(s, y) < st->src;
+}
+
+/* decode the lines that have everything they need */
+static void
+stream_decode(struct CRT *v, struct CRT_STREAM *st)
+{
+    int first = st->line, last = st->line;
+    int beg, end, n;
+    
+    while (last < CRT_LINES) {
+        /* the sync pass reads its own line and the next one, the line is
+         * decoded from ynudge (3) lines down and may run into the next */
+        n = CRT_TOP + last + v->vsync;
+        if (!line_ready(st, n) || !line_ready(st, n + 1) ||
+            !line_ready(st, n + 3) || !line_ready(st, n + 4)) {
+            break;
+        }
+        last++;
+    }
+    if (last == first) {
+        return;
+    }
+    sync_lines(v, first, last);
+    demodulate_lines(v, v->yiq, first, last, 1);
+    st->line = last;
+    
+    if (v->field_only) {
+        beg = first;
+        end = last;
+    } else {
+        beg = line_to_row(v, CRT_TOP + first, 0);
+        end = line_to_row(v, CRT_TOP + last - 1, 1);
+    }
+    if (end > v->outh) {
+        end = v->outh;
+    }
+    if (st->rows_done && beg < end) {
+        st->rows_done(st->ctx, beg, end);
+    }
+}
+
+extern void
+crt_stream_begin(struct CRT *v, struct CRT_STREAM *st,
+                 struct NTSC_SETTINGS *s, int noise,
+                 void (*rows_done)(void *ctx, int beg, int end), void *ctx)
+{
+    st->s = s;
+    st->noise = noise;
+    st->rows_done = rows_done;
+    st->ctx = ctx;
+    st->dirty = s->dirty;
+    st->src = 0;
+    st->line = 0;
+    
+    /* the blanking and sync of the field, the image only if the settings
+     * changed since the last field (whatever is in it for now) */
+    memset(st->rows, 0, sizeof(st->rows));
+    s->dirty = (s->h <= CRT_STREAM_ROWS) ? st->rows : NULL;
+#if (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
+    st->vhs_rn = s->rn;
+#endif
+    crt_modulate(v, s);
+    s->dirty = st->dirty;
+    
+    if (crt_bpp4fmt(v->out_format) == 0) {
+        st->line = CRT_LINES; /* nothing to decode */
+        return;
+    }
+    st->rn = v->rn;
+    sync_field(v, noise);
+    stream_decode(v, st);
+}
+
+extern void
+crt_stream_rows(struct CRT *v, struct CRT_STREAM *st, int rows)
+{
+    struct NTSC_SETTINGS *s = st->s;
+    int ccf[CRT_CC_VPER][CRT_CC_SAMPLES];
+    int hsync, y0, y1;
+    
+    if (rows > s->h) {
+        rows = s->h;
+    }
+    if (rows <= st->src || (s->h > CRT_STREAM_ROWS && rows < s->h)) {
+        return;
+    }
+    /* analog lines [y0, y1) of the image are the new rows */
+    y0 = 0;
+    while (y0 < s->rs_desth && line_row(s, y0) < st->src) {
+        y0++;
+    }
+    y1 = y0;
+    while (y1 < s->rs_desth && (rows == s->h || line_row(s, y1) < rows)) {
+        y1++;
+    }
+    
+    if (s->h <= CRT_STREAM_ROWS) {
+        memset(st->rows, 0, s->h);
+        memset(st->rows + st->src, 1, rows - st->src);
+        s->dirty = st->rows;
+    } else {
+        s->dirty = NULL;
+        y0 = 0;
+        y1 = s->rs_desth;
+    }
+    /* the sync pass is already locking on to the color burst and hsync
+     * of this field, modulating would start them over */
+    memcpy(ccf, v->ccf, sizeof(ccf));
+    hsync = v->hsync;
+#if (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
+    /* roll the same aberration again, the field only gets one */
+    s->rn = st->vhs_rn;
+#endif
+    crt_modulate(v, s);
+    memcpy(v->ccf, ccf, sizeof(ccf));
+    v->hsync = hsync;
+    s->dirty = st->dirty;
+    st->src = rows;
+    
+    if (st->line < CRT_LINES) {
+        refresh_input(v, st, (s->dl_key[1] + y0) * CRT_HRES,
+                      (s->dl_key[1] + y1) * CRT_HRES);
+        stream_decode(v, st);
+    }
+}
+
+extern void
+crt_stream_end(struct CRT *v, struct CRT_STREAM *st)
+{
+    crt_stream_rows(v, st, st->s->h);
+}
+
+extern void
+crt_get_stats(struct CRT *v, struct CRT_STATS *st, int clear)
+{
+#if CRT_DO_STATS
+    *st = v->stats;
+    if (clear) {
+        memset(&v->stats, 0, sizeof(v->stats));
+    }
+#else
+    (void) v;
+    (void) clear;
+    memset(st, 0, sizeof(struct CRT_STATS));
+#endif
 }
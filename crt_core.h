@@ -58,6 +58,36 @@ extern "C" {
 #error No system defined
 #endif
 
+#ifdef CRT_MULTI_BACKEND
+/* this is being compiled as one of the systems of crt_multi.c (see
+ * crt_multi.h) so give the functions of each system their own names,
+ * that way all of them can be linked into the same program
+ */
+#define CRT_CAT_(a, b) a##b
+#define CRT_CAT(a, b)  CRT_CAT_(a, b)
+#define crt_init              CRT_CAT(crt_init_, CRT_SYSTEM)
+#define crt_resize            CRT_CAT(crt_resize_, CRT_SYSTEM)
+#define crt_reset             CRT_CAT(crt_reset_, CRT_SYSTEM)
+#define crt_modulate          CRT_CAT(crt_modulate_, CRT_SYSTEM)
+#define crt_demodulate        CRT_CAT(crt_demodulate_, CRT_SYSTEM)
+#define crt_demodulate_sync   CRT_CAT(crt_demodulate_sync_, CRT_SYSTEM)
+#define crt_demodulate_lines  CRT_CAT(crt_demodulate_lines_, CRT_SYSTEM)
+#define crt_demodulate_still  CRT_CAT(crt_demodulate_still_, CRT_SYSTEM)
+#define crt_demodulate_dirty  CRT_CAT(crt_demodulate_dirty_, CRT_SYSTEM)
+#define crt_demodulate_signal CRT_CAT(crt_demodulate_signal_, CRT_SYSTEM)
+#define crt_set_buffers       CRT_CAT(crt_set_buffers_, CRT_SYSTEM)
+#define crt_field_map         CRT_CAT(crt_field_map_, CRT_SYSTEM)
+#define crt_stream_begin      CRT_CAT(crt_stream_begin_, CRT_SYSTEM)
+#define crt_stream_rows       CRT_CAT(crt_stream_rows_, CRT_SYSTEM)
+#define crt_stream_end        CRT_CAT(crt_stream_end_, CRT_SYSTEM)
+#define crt_set_targets       CRT_CAT(crt_set_targets_, CRT_SYSTEM)
+#define crt_fade              CRT_CAT(crt_fade_, CRT_SYSTEM)
+#define crt_get_stats         CRT_CAT(crt_get_stats_, CRT_SYSTEM)
+#define crt_bpp4fmt           CRT_CAT(crt_bpp4fmt_, CRT_SYSTEM)
+#define crt_offsets4fmt       CRT_CAT(crt_offsets4fmt_, CRT_SYSTEM)
+#define crt_sincos14          CRT_CAT(crt_sincos14_, CRT_SYSTEM)
+#endif
+
 /* NOTE: this library does not use the alpha channel at all */
 #define CRT_PIX_FORMAT_RGB  0  /* 3 bytes per pixel [R,G,B,R,G,B,R,G,B...] */
 #define CRT_PIX_FORMAT_BGR  1  /* 3 bytes per pixel [B,G,R,B,G,R,B,G,R...] */
@@ -71,9 +101,157 @@ extern "C" {
 #define CRT_DO_VSYNC    1  /* look for VSYNC */
 #define CRT_DO_HSYNC    1  /* look for HSYNC */
 
+/* 1 = struct CRT contains its own signal buffers,
+ * 0 = the signal buffers have to be given by crt_set_buffers(), which makes
+ *     struct CRT 2 * CRT_INPUT_SIZE bytes smaller
+ */
+#define CRT_OWN_BUFFERS 1
+
+/* 1 = leave out the noisy copy of the signal (CRT.inp), the noise gets
+ *     added to the parts of analog the demodulator reads as it reads them.
+ *     the output is the same, the signal takes half the memory
+ *     (see the README for the memory used)
+ * 0 = the noise is added to the whole field at once
+ */
+#ifndef CRT_COMPACT
+#define CRT_COMPACT 0
+#endif
+
+/* 1 = time the stages of crt_modulate() and crt_demodulate() and count what
+ *     the sync search does, see crt_get_stats()
+ * 0 = none of it gets compiled in
+ */
+#ifndef CRT_DO_STATS
+#define CRT_DO_STATS 0
+#endif
+
+#if CRT_DO_STATS
+/* the time source of the stats, define these before including crt_core.h
+ * to use a finer one (clock() is CPU time and usually 1 microsecond steps)
+ */
+#ifndef CRT_STATS_CLOCK
+#include <time.h>
+#define CRT_STATS_CLOCK() ((long) clock())
+#define CRT_STATS_HZ      ((long) CLOCKS_PER_SEC)
+#endif
+/* t is a long the current stage started at, LAP adds the time since then
+ * to stat f of v and starts the next stage (internal) */
+#define CRT_STAT_BEG(t) ((t) = CRT_STATS_CLOCK())
+#define CRT_STAT_LAP(v, f, t) \
+    do { long crt_now_ = CRT_STATS_CLOCK(); \
+         (v)->stats.f += crt_now_ - (t); (t) = crt_now_; } while (0)
+#define CRT_STAT_ADD(v, f, n) ((v)->stats.f += (n))
+#else
+#define CRT_STAT_BEG(t)
+#define CRT_STAT_LAP(v, f, t)
+#define CRT_STAT_ADD(v, f, n)
+#endif
+
+/* convolution is much faster but the EQ looks softer, more authentic, and more analog */
+#define USE_CONVOLUTION 0
+#define USE_7_SAMPLE_KERNEL 1
+#define USE_6_SAMPLE_KERNEL 0
+#define USE_5_SAMPLE_KERNEL 0
+
+#if (CRT_CC_SAMPLES != 4)
+/* the current convolutions do not filter properly at > 4 samples */
+#undef USE_CONVOLUTION
+#define USE_CONVOLUTION 0
+#endif
+
+#if USE_CONVOLUTION
+/* the kernel is fixed, nothing to set up */
+struct EQF {
+    int unused;
+};
+#else
+#define HISTLEN     3
+/* three band equalizer, the filter state is kept while decoding a line */
+struct EQF {
+    int lf, hf; /* fractions */
+    int g[3]; /* gains */
+};
+#endif
+
+/* most extra output images a field can be drawn into */
+#define CRT_MAX_TARGETS 8
+
+/* an extra output image, see crt_set_targets() */
+struct CRT_TARGET {
+    int w, h; /* width/height */
+    int format; /* pixel format (one of the CRT_PIX_FORMATs) */
+    int pitch; /* bytes per row, 0 = w * bytes per pixel */
+    unsigned char *out; /* image data */
+};
+
+/* one decoded sample of a scan line */
+struct CRT_YIQ {
+    int y, i, q;
+};
+
+/* sync and color burst information found for one active video line */
+struct CRT_LINE {
+    int pos; /* start of active video in the input signal */
+#if (CRT_CC_SAMPLES == 4)
+    int wave[CRT_CC_SAMPLES];
+#else
+    int waveI[CRT_CC_SAMPLES];
+    int waveQ[CRT_CC_SAMPLES];
+#endif
+#if CRT_DO_BLOOM
+    int line_w; /* width of the scan line after bloom */
+#endif
+};
+
+/* everything besides the signal that the decoded image depends on
+ * (internal, see crt_demodulate_dirty())
+ */
+struct CRT_DD_KEY {
+    int outw, outh, out_format;
+    int hue, brightness, contrast, saturation, black_point;
+    int scanlines, blend, field;
+    int v_fac, field_only, persistence;
+    int ntargets;
+    struct CRT_TARGET targets[CRT_MAX_TARGETS]; /* copies, see crt_set_targets() */
+};
+
+/* where the time goes (see CRT_DO_STATS), everything adds up since the last
+ * time the stats were cleared. the times are in CRT_STATS_CLOCK() ticks
+ */
+struct CRT_STATS {
+    /* crt_demodulate() */
+    long noise;  /* adding noise to the signal */
+    long vsync;  /* looking for vertical sync */
+    long hsync;  /* looking for horizontal sync */
+    long burst;  /* locking on to the color burst (and bloom) */
+    long eq;     /* running the lines through the equalizers */
+    long rgb;    /* YIQ to RGB, storing and blending the pixels */
+    long dup;    /* duplicating lines to fill the output */
+    /* crt_modulate() */
+    long blank;  /* setting up the field and its blanking */
+    long sync;   /* sync pulses and color burst */
+    long active; /* active video */
+    
+    long modulated;   /* fields made by crt_modulate() */
+    long synced;      /* sync passes (crt_demodulate_sync() calls) */
+    long lines;       /* lines decoded */
+    long vsync_iter;  /* samples integrated looking for vertical sync */
+    long hsync_iter;  /* samples integrated looking for horizontal sync */
+    long vsync_lost;  /* passes that didn't find vertical sync */
+    long hsync_lost;  /* lines that didn't find horizontal sync */
+};
+
+/* NOTE: all of the state used by the demodulator lives in here, so separate
+ * CRT instances (each with their own NTSC_SETTINGS) can be used on separate
+ * threads at the same time.
+ * Don't copy a CRT by value, the copy's analog/inp still point at the
+ * original's signal buffers. Give the copy its own with crt_set_buffers()
+ * (or crt_init() a new one and copy the settings over).
+ */
 struct CRT {
-    signed char analog[CRT_INPUT_SIZE];
-    signed char inp[CRT_INPUT_SIZE]; /* CRT input, can be noisy */
+    /* CRT_INPUT_SIZE samples each, see crt_set_buffers() */
+    signed char *analog; /* signal written by crt_modulate() */
+    signed char *inp; /* CRT input, can be noisy (unused with CRT_COMPACT) */
 
     int outw, outh; /* output width/height */
     int out_format; /* output pixel format (one of the CRT_PIX_FORMATs) */
@@ -83,15 +261,70 @@ struct CRT {
     int black_point, white_point; /* user-adjustable */
     int scanlines; /* leave gaps between lines if necessary */
     int blend; /* blend new field onto previous image */
+    /* 0-256 share of the previous image kept by blending, the default of
+     * 128 averages the new field with it */
+    int persistence;
+    int field_only; /* 1 = one output row per line, see crt_field_map() */
     unsigned v_fac; /* factor to stretch img vertically onto the output img */
 
     /* internal data */
     int ccf[CRT_CC_VPER][CRT_CC_SAMPLES]; /* faster color carrier convergence */
     int hsync, vsync; /* keep track of sync over frames */
-    int rn; /* seed for the 'random' noise */
+    int rn; /* seed for the 'random' noise, can be set to reseed it */
+    struct EQF eqY, eqI, eqQ; /* equalizers used to decode the signal */
+    struct CRT_YIQ yiq[AV_LEN + 1]; /* scan line being decoded */
+    struct CRT_LINE lines[CRT_LINES]; /* per line results of the sync pass */
+    int field; /* field found by the sync pass */
+    signed char *sig; /* signal found by the sync pass (inp or analog) */
+    int sy_huesn, sy_huecs; /* hue the sync pass locks the color burst to */
+#if CRT_DO_BLOOM
+    int sy_prev_e, sy_max_e; /* beam energy so far in the sync pass */
+#endif
+#if CRT_COMPACT
+    int sy_noise, sy_rn; /* noise of the field and its seed */
+#endif
+#if ((CRT_SYSTEM == CRT_SYSTEM_NTSCVHS) && CRT_VHS_NOISE)
+    int vhs_beg, vhs_end, vhs_freq, vhs_seed; /* tracking noise band */
+#endif
+#if (CRT_CC_SAMPLES == 5)
+    /* sin/cos of the hue adjustment for each chroma sample of I and Q,
+     * only recalculated when hue changes */
+    int hue_valid, hue_tab;
+    int hue_sn[2][CRT_CC_SAMPLES];
+    int hue_cs[2][CRT_CC_SAMPLES];
+#endif
+    
+    /* analog lines rewritten by crt_modulate() since the last
+     * crt_demodulate_dirty(), set them too if you change analog yourself */
+    unsigned char changed[CRT_VRES];
+    /* 1 = analog has the blanking and sync crt_modulate() sets up for the
+     * active video area below (the NES systems don't use the area), clear
+     * it if you write over analog yourself */
+    int fld_valid;
+    int fld_xo, fld_yo, fld_w, fld_h;
+    /* internal state of crt_demodulate_dirty() */
+    int dd_valid;
+    struct CRT_DD_KEY dd_key;
+    unsigned char *dd_out;
+    unsigned char dd_redo[CRT_LINES]; /* times each line still needs decoding */
+    struct CRT_LINE dd_lines[CRT_LINES]; /* sync results of the last pass */
+    /* extra output images, see crt_set_targets() */
+    struct CRT_TARGET *targets;
+    int ntargets;
+#if CRT_DO_STATS
+    struct CRT_STATS stats;
+#endif
+#if CRT_OWN_BUFFERS
+    signed char analog_buf[CRT_INPUT_SIZE];
+#if !CRT_COMPACT
+    signed char inp_buf[CRT_INPUT_SIZE];
+#endif
+#endif
 };
 
 /* Initializes the library. Sets up filters.
+ * With CRT_OWN_BUFFERS the signal buffers are the CRT's own (cleared) ones,
+ * otherwise crt_set_buffers() has to be called before anything else.
  *   w   - width of the output image
  *   h   - height of the output image
  *   f   - format of the output image
@@ -99,6 +332,17 @@ struct CRT {
  */
 extern void crt_init(struct CRT *v, int w, int h, int f, unsigned char *out);
 
+/* Uses caller-owned signal buffers of CRT_INPUT_SIZE samples each.
+ * The next crt_modulate() writes the blanking and sync into analog again
+ * (see CRT.fld_valid), but leaves the rest of it as it is, so clear analog
+ * first unless it already holds a signal that should be drawn over.
+ *   analog - signal written by crt_modulate() and read by crt_demodulate()
+ *   inp    - the noisy copy of analog the demodulator reads when there
+ *            is noise, can be NULL with CRT_COMPACT
+ */
+extern void crt_set_buffers(struct CRT *v, signed char *analog,
+                            signed char *inp);
+
 /* Updates the output image parameters
  *   w   - width of the output image
  *   h   - height of the output image
@@ -120,6 +364,161 @@ extern void crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s);
  */
 extern void crt_demodulate(struct CRT *v, int noise);
 
+/* crt_demodulate() is done in two passes that can also be called separately,
+ * this lets you split the expensive part (decoding the active video lines)
+ * across multiple threads:
+ * 
+ *   crt_demodulate_sync(&crt, noise);
+ *   on each thread:
+ *       crt_demodulate_lines(&crt, own_yiq_buffer, first, last);
+ *   wait for all threads to finish
+ */
+
+/* Adds noise to the signal, finds vertical and horizontal sync and locks
+ * onto the color burst of each line. This pass is sequential and cheap.
+ *   noise - the amount of noise added to the signal (0 - inf)
+ */
+extern void crt_demodulate_sync(struct CRT *v, int noise);
+
+/* Decodes active video lines [first, last) found by crt_demodulate_sync()
+ * into the output image. Every line only writes to its own output rows,
+ * so disjoint ranges can be decoded at the same time.
+ *   buf         - scratch space of AV_LEN + 1 entries, each thread that is
+ *                 decoding at the same time needs its own (v->yiq is free to
+ *                 be used by one of them)
+ *   first, last - range of lines to decode, 0 to CRT_LINES
+ */
+extern void crt_demodulate_lines(struct CRT *v, struct CRT_YIQ *buf,
+                                 int first, int last);
+
+/* Demodulates a still image in one go, the output ends up the same as it
+ * would after calling crt_demodulate() on the same field until the blending
+ * and sync stop changing it. Use it instead of accumulating many fields
+ * when converting single images.
+ * For interlaced output, modulate and call this once for each field. The
+ * color carrier phase flips every frame, so after that modulate both fields
+ * again with the other frame and crt_demodulate() them with blending on to
+ * average out the dot crawl (crt_main.c -q does this).
+ *   noise - the amount of noise added to the signal (0 - inf)
+ */
+extern void crt_demodulate_still(struct CRT *v, int noise);
+
+/* Same as crt_demodulate() but only decodes the lines whose part of the
+ * signal (see CRT.changed) or sync changed since the last call, the rest of
+ * the output image is left as is. Use it together with the dirty rows in
+ * NTSC_SETTINGS for mostly static images.
+ * The output image must not be touched by anything else between calls,
+ * everything gets decoded again if any of the settings in struct CRT or the
+ * output image change, or if there is noise.
+ *   noise - the amount of noise added to the signal (0 - inf)
+ */
+extern void crt_demodulate_dirty(struct CRT *v, int noise);
+
+/* Same as crt_demodulate() but decodes a signal that did not come from
+ * crt_modulate(), e.g. one made or captured by something else, without
+ * copying it into the CRT. It has the same layout as CRT.analog:
+ * CRT_VRES lines of CRT_HRES samples, sync at SYNC_LEVEL, blank at
+ * BLANK_LEVEL, and so on (see the system's header). It is only read and
+ * only has to stay around during the call.
+ *   sig   - the signal, CRT_INPUT_SIZE samples
+ *   noise - the amount of noise added to the signal (0 - inf)
+ */
+extern void crt_demodulate_signal(struct CRT *v, const signed char *sig,
+                                  int noise);
+
+/* most source image rows crt_stream_rows() can modulate a few at a time,
+ * taller images get modulated all at once when the last row comes in */
+#define CRT_STREAM_ROWS 1024
+
+/* a field that is being streamed in, see crt_stream_begin() */
+struct CRT_STREAM {
+    struct NTSC_SETTINGS *s;
+    int noise;
+    void (*rows_done)(void *ctx, int beg, int end);
+    void *ctx;
+    
+    /* internal state */
+    const unsigned char *dirty; /* the caller's s->dirty */
+    int src;  /* source rows modulated so far */
+    int line; /* active lines decoded so far */
+    int rn;   /* noise seed at the start of the field */
+#if (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
+    int vhs_rn; /* s->rn before the field, the aberration is rolled from it */
+#endif
+    unsigned char rows[CRT_STREAM_ROWS]; /* rows for s->dirty */
+};
+
+/* "Race the beam" decoding for emulators that make the image a few rows at
+ * a time. Instead of crt_modulate() + crt_demodulate() of a whole field,
+ * the rows get modulated as they come in and every output row gets decoded
+ * as soon as the signal it needs (sync included) is there, so it can be
+ * shown right away. The output is the same as the whole field at once.
+ *   st        - state of the field, can be on the stack
+ *   s         - settings of the field, rows not in yet can hold anything.
+ *               don't change them (other than the image rows) until
+ *               crt_stream_end()
+ *   noise     - same as crt_demodulate()
+ *   rows_done - called with output rows [beg, end) every time some are
+ *               done (compact rows with CRT.field_only), can be NULL
+ *   ctx       - passed on to rows_done
+ */
+extern void crt_stream_begin(struct CRT *v, struct CRT_STREAM *st,
+                             struct NTSC_SETTINGS *s, int noise,
+                             void (*rows_done)(void *ctx, int beg, int end),
+                             void *ctx);
+
+/* Source rows [0, rows) of the image are ready */
+extern void crt_stream_rows(struct CRT *v, struct CRT_STREAM *st, int rows);
+
+/* The whole image is ready, decodes what is left of the field */
+extern void crt_stream_end(struct CRT *v, struct CRT_STREAM *st);
+
+/* With CRT.field_only set, the output image gets one row per decoded line
+ * (outw * CRT_LINES pixels at most) instead of being stretched to outh rows,
+ * no rows are duplicated and no scanline gaps are left. outh is still the
+ * height of the image the field would have been stretched to, and this gives
+ * the rows each compact row would have covered in it so the stretch can be
+ * done somewhere else (e.g. by a shader). Rows beg[i] to end[i] - scanlines
+ * are the ones that would have been copies of compact row i, the rest are
+ * the scanline gap. Blending blends onto the same compact row, which holds
+ * that line of the previous field.
+ * The mapping depends on the field found when demodulating, so get it after
+ * each crt_demodulate() (or any of the others).
+ *   beg, end - receive the first row and the row after the last one of
+ *              each compact row, CRT_LINES entries each
+ * returns the number of compact rows, only that many entries are filled in
+ */
+extern int crt_field_map(struct CRT *v, int *beg, int *end);
+
+/* Also draws every decoded field into other output images, each with its
+ * own size and pixel format (e.g. a full size window and a small preview).
+ * The signal is only synced and decoded once per line, only drawing the
+ * line is done for each image. The sync pass and crt_stream_rows() still go
+ * by the CRT's own output size, the settings (scanlines, blend, field_only..)
+ * apply to all of them, with field_only each one needs CRT_LINES rows.
+ * The array is used as it is until this is called again, so targets can be
+ * changed in place between fields (crt_demodulate_dirty() notices, it keeps
+ * a copy of them). crt_fade() fades them too.
+ *   t - array of n targets, NULL for none
+ *   n - number of targets, at most CRT_MAX_TARGETS are used
+ */
+extern void crt_set_targets(struct CRT *v, struct CRT_TARGET *t, int n);
+
+/* Fades the whole output image, like phosphors that keep glowing for a
+ * while after the beam has passed. Call it before demodulating the next
+ * field (for a live display), only the rows that field touches get
+ * brightened again.
+ *   keep - fraction of each channel that is kept, 0 (black) to 256 (as is)
+ */
+extern void crt_fade(struct CRT *v, int keep);
+
+/* Gets the stats collected since they were last cleared (all zero when
+ * compiled without CRT_DO_STATS)
+ *   st    - where to put them
+ *   clear - 1 = start counting from zero again
+ */
+extern void crt_get_stats(struct CRT *v, struct CRT_STATS *st, int clear);
+
 /* Get the bytes per pixel for a certain CRT_PIX_FORMAT_
  * 
  *   format - the format to get the bytes per pixel for
@@ -128,6 +527,16 @@ extern void crt_demodulate(struct CRT *v, int noise);
  */
 extern int crt_bpp4fmt(int format);
 
+/* Get the byte offsets of the red, green, and blue channels within a pixel
+ * of a certain CRT_PIX_FORMAT_
+ * 
+ *   format  - the format to get the offsets for
+ *   r, g, b - receive the offsets (all 0 if the format does not exist)
+ *   
+ * returns the bytes per pixel, 0 if the specified format does not exist
+ */
+extern int crt_offsets4fmt(int format, int *r, int *g, int *b);
+
 /*****************************************************************************/
 /*************************** FIXED POINT SIN/COS *****************************/
 /*****************************************************************************/
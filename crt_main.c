@@ -15,6 +15,7 @@
 #include <errno.h>
 #include "ppm_rw.h"
 #include "bmp_rw.h"
+#include "sig_rw.h"
 #include "crt_core.h"
 
 #ifndef CMD_LINE_VERSION
@@ -43,6 +44,7 @@ static int progressive = 0;
 static int raw = 0;
 static int hue = 0;
 static int save_analog = 0;
+static int quick = 0;
 
 static int
 stoint(char *s, int *err)
@@ -70,7 +72,7 @@ static void
 usage(char *p)
 {
     printf(DRV_HEADER);
-    printf("usage: %s -m|o|f|p|r|h|a outwidth outheight noise artifact_hue infile outfile\n", p);
+    printf("usage: %s -m|o|f|p|r|q|h|a outwidth outheight noise artifact_hue infile outfile\n", p);
     printf("sample usage: %s -op 640 480 24 0 in.ppm out.ppm\n", p);
     printf("sample usage: %s - 832 624 0 90 in.ppm out.ppm\n", p);
     printf("-- NOTE: the - after the program name is required\n");
@@ -81,10 +83,15 @@ usage(char *p)
     printf("\tf : odd field (only meaningful in progressive mode)\n");
     printf("\tp : progressive scan (rather than interlaced)\n");
     printf("\tr : raw image (needed for images that use artifact colors)\n");
+    printf("\tq : quick, converge the still in one go (slightly different)\n");
     printf("\ta : save analog signal as image instead of decoded image\n");
     printf("\th : print help\n");
     printf("\n");
     printf("by default, the image will be full color, interlaced, and scaled to the output dimensions\n");
+    printf("\n");
+    printf("if outfile ends in .sig, the modulated fields are saved to it instead (see sig_rw.h)\n");
+    printf("if infile ends in .sig, its fields are decoded without modulating anything,\n");
+    printf("artifact_hue then sets the hue of the monitor instead\n");
 }
 
 static int
@@ -103,6 +110,7 @@ process_args(int argc, char **argv)
             case 'f': field = 1;       break;
             case 'p': progressive = 1; break;
             case 'r': raw = 1;         break;
+            case 'q': quick = 1;       break;
             case 'a': save_analog = 1; break;
             case 'h': usage(argv[0]); return 0;
             default:
@@ -143,13 +151,118 @@ promptoverwrite(char *fn)
     return 1;
 }
 
+/* by default a still is 4 accumulated frames (2 fields each when
+ * interlaced). with -q it is both fields of two frames instead, the first
+ * frame converged in one go: the color carrier phase flips every frame and
+ * that is what averages out the dot crawl
+ */
+#define STILL_FIELDS (quick ? (progressive ? 1 : 4) : (progressive ? 4 : 8))
+
+/* set up field n of a still image */
+static void
+still_field(struct NTSC_SETTINGS *ntsc, int n)
+{
+    ntsc->field = field & 1;
+    if (progressive) {
+        return;
+    }
+    if (quick) {
+        ntsc->field = (field + n) & 1;
+        ntsc->frame = (n < 2);
+    } else {
+        /* each frame starts with the field the last one ended with, and
+         * the frame flips after every other one */
+        ntsc->field = (field + (n + 1) / 2) & 1;
+        ntsc->frame = ((n / 2 + 1) / 2) & 1;
+    }
+}
+
+/* with -q the first field of each parity converges in one go, the ones
+ * after it (and all of them by default) get blended like any other field.
+ * sig is decoded in place of CRT.analog when it isn't NULL
+ */
+static void
+decode_still(struct CRT *crt, const signed char *sig, int noise, int n)
+{
+    signed char *analog = crt->analog;
+    
+    if (!quick || n >= 2) {
+        if (sig) {
+            crt_demodulate_signal(crt, sig, noise);
+        } else {
+            crt_demodulate(crt, noise);
+        }
+        return;
+    }
+    /* there is no signal version of crt_demodulate_still(), but the
+     * demodulator only reads analog so point it at sig the same way
+     * crt_demodulate_signal() does */
+    if (sig) {
+        crt->analog = (signed char *) sig;
+    }
+    crt_demodulate_still(crt, noise);
+    crt->analog = analog;
+}
+
+/* modulate the field(s) that would be decoded into a signal file */
+static int
+save_signal(struct CRT *crt, struct NTSC_SETTINGS *ntsc, char *name)
+{
+    struct SIG_FILE sf;
+    int i, ok = 1;
+
+    if (!sig_create(&sf, name, CRT_SYSTEM,
+                    CRT_HRES, CRT_VRES, CRT_CC_VPER, CRT_CC_SAMPLES)) {
+        return 0;
+    }
+    for (i = 0; i < STILL_FIELDS && ok; i++) {
+        still_field(ntsc, i);
+        crt_modulate(crt, ntsc);
+        ok = sig_write(&sf, crt->analog, ntsc->field, &crt->ccf[0][0]);
+    }
+    return sig_close(&sf) && ok;
+}
+
+/* decode every field of a signal file in place of crt_modulate() */
+static int
+replay_signal(struct CRT *crt, char *name, int noise)
+{
+    struct SIG_FILE sf;
+    int i;
+
+    if (!sig_open(&sf, name)) {
+        return 0;
+    }
+    if (sf.system != CRT_SYSTEM || sf.hres != CRT_HRES ||
+        sf.vres != CRT_VRES || sf.cc_vper != CRT_CC_VPER ||
+        sf.cc_samples != CRT_CC_SAMPLES) {
+        printf("signal file is for a different CRT_SYSTEM (%d)\n", sf.system);
+        sig_close(&sf);
+        return 0;
+    }
+    printf("replaying %d field(s)...\n", sf.nfields);
+    for (i = 0; i < sf.nfields; i++) {
+        const signed char *sig;
+
+        /* same state crt_modulate() would have left behind */
+        sig = sig_field(&sf, i, NULL, &crt->ccf[0][0]);
+#if (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
+        crt->hsync = 0;
+#endif
+        /* straight out of the mapped file, no copy */
+        decode_still(crt, sig, noise, i);
+    }
+    sig_close(&sf);
+    return 1;
+}
+
 int
 main(int argc, char **argv)
 {
     struct NTSC_SETTINGS ntsc;
     struct CRT crt;
-    int *img;
-    int imgw, imgh;
+    int *img = NULL;
+    int imgw = 0, imgh = 0;
     int *output = NULL;
     int outw = 832;
     int outh = 624;
@@ -157,6 +270,8 @@ main(int argc, char **argv)
     char *input_file;
     char *output_file;
     int err = 0;
+    int i;
+    int replay = 0;
 
     if (argc < 8) {
         usage(argv[0]);
@@ -201,7 +316,9 @@ main(int argc, char **argv)
     input_file = argv[6];
     output_file = argv[7];
 
-    if (cmpsuf(input_file, ".ppm", 4) == 0) {
+    if (cmpsuf(input_file, ".sig", 4) == 0) {
+        replay = 1;
+    } else if (cmpsuf(input_file, ".ppm", 4) == 0) {
         if (!ppm_read24(input_file, &img, &imgw, &imgh, calloc)) {
             printf("unable to read image\n");
             return EXIT_FAILURE;
@@ -212,7 +329,9 @@ main(int argc, char **argv)
             return EXIT_FAILURE;
         }
     }
-    printf("loaded %d %d\n", imgw, imgh);
+    if (!replay) {
+        printf("loaded %d %d\n", imgw, imgh);
+    }
 
     if (!promptoverwrite(output_file)) {
         return EXIT_FAILURE;
@@ -220,6 +339,7 @@ main(int argc, char **argv)
 
     crt_init(&crt, outw, outh, CRT_PIX_FORMAT_BGRA, output);
 
+    memset(&ntsc, 0, sizeof(ntsc));
     ntsc.data = img;
     ntsc.format = CRT_PIX_FORMAT_BGRA;
     ntsc.w = imgw;
@@ -233,23 +353,31 @@ main(int argc, char **argv)
     crt.blend = 1;
     crt.scanlines = 1;
 
+    if (cmpsuf(output_file, ".sig", 4) == 0 && !replay) {
+        if (!save_signal(&crt, &ntsc, output_file)) {
+            printf("unable to write signal\n");
+            return EXIT_FAILURE;
+        }
+        printf("done\n");
+        return EXIT_SUCCESS;
+    }
+
     printf("converting to %dx%d...\n", outw, outh);
-    err = 0;
-   
-    /* accumulate 4 frames */
-    while (err < 4) {
-        crt_modulate(&crt, &ntsc);
-        crt_demodulate(&crt, noise);
-        if (!progressive) {
-            ntsc.field ^= 1;
+
+    if (replay) {
+        /* the hue was part of the signal, turn the one on the monitor */
+        crt.hue = hue;
+        if (!replay_signal(&crt, input_file, noise)) {
+            printf("unable to replay signal\n");
+            return EXIT_FAILURE;
+        }
+    } else {
+        /* accumulate the fields of the still (see STILL_FIELDS) */
+        for (i = 0; i < STILL_FIELDS; i++) {
+            still_field(&ntsc, i);
             crt_modulate(&crt, &ntsc);
-            crt_demodulate(&crt, noise);
-            if ((err & 1) == 0) {
-                /* a frame is two fields */
-                ntsc.frame ^= 1;
-            }
+            decode_still(&crt, NULL, noise, i);
         }
-        err++;
     }
         
     if (save_analog) {
@@ -421,12 +549,8 @@ updatecb(void)
          * their values resulting in the previous image being
          * displayed where the new, smaller image is not
          */
-#if (CRT_SYSTEM == CRT_SYSTEM_NTSC)
-        /* clearing the analog buffer with optimized NES mode will cause the
-         * image to break since the field does not get repopulated
-         */
-        memset(crt.analog, 0, sizeof(crt.analog));
-#endif
+        memset(crt.analog, 0, CRT_INPUT_SIZE);
+        crt.fld_valid = 0; /* have crt_modulate() put the sync back */
         raw ^= 1;
         printf("raw: %d\n", raw);
     }
@@ -460,7 +584,7 @@ displaycb(void)
         memset(video, 0, info->width * info->height * sizeof(int));
     }
     /* not necessary to clear if you're rendering on a constant region of the display */
-    /* memset(crt.analog, 0, sizeof(crt.analog)); */
+    /* memset(crt.analog, 0, CRT_INPUT_SIZE); */
 #if (CRT_SYSTEM == CRT_SYSTEM_NES)
     ntsc.data = ppu_output_256x240;
     ntsc.border_color = 0x22;
@@ -0,0 +1,426 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+/* crt_multi.c
+ *
+ * compiled once with CRT_MULTI_DISPATCH for the dispatcher and once per
+ * system with CRT_MULTI_BACKEND and CRT_SYSTEM for that system's backend,
+ * see crt_multi.h (does nothing in a normal build)
+ */
+
+#if defined(CRT_MULTI_BACKEND)
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "crt_core.h"
+#include "crt_multi.h"
+
+/* struct CRT_MULTI_TARGET arrays are passed on as they are */
+typedef char be_check_target[
+    (sizeof(struct CRT_MULTI_TARGET) == sizeof(struct CRT_TARGET) &&
+     offsetof(struct CRT_MULTI_TARGET, pitch) ==
+     offsetof(struct CRT_TARGET, pitch) &&
+     offsetof(struct CRT_MULTI_TARGET, out) ==
+     offsetof(struct CRT_TARGET, out)) ? 1 : -1];
+
+static void *
+be_create(int w, int h, int f, unsigned char *out)
+{
+    struct CRT *v;
+
+    v = malloc(sizeof(struct CRT));
+    if (v != NULL) {
+        crt_init(v, w, h, f, out);
+    }
+    return v;
+}
+
+static void *
+be_create_settings(void)
+{
+    /* NTSC_SETTINGS need to be zeroed out */
+    return calloc(1, sizeof(struct NTSC_SETTINGS));
+}
+
+static void *
+be_create_stream(void)
+{
+    return calloc(1, sizeof(struct CRT_STREAM));
+}
+
+static void
+be_resize(void *crt, int w, int h, int f, unsigned char *out)
+{
+    crt_resize(crt, w, h, f, out);
+}
+
+static void
+be_set_buffers(void *crt, signed char *analog, signed char *inp)
+{
+    crt_set_buffers(crt, analog, inp);
+}
+
+static void
+be_reset(void *crt)
+{
+    crt_reset(crt);
+}
+
+static void
+be_get_params(void *crt, struct CRT_MULTI *m)
+{
+    struct CRT *v = crt;
+
+    m->hue = v->hue;
+    m->brightness = v->brightness;
+    m->contrast = v->contrast;
+    m->saturation = v->saturation;
+    m->black_point = v->black_point;
+    m->white_point = v->white_point;
+    m->scanlines = v->scanlines;
+    m->blend = v->blend;
+    m->persistence = v->persistence;
+    m->field_only = v->field_only;
+}
+
+static void
+be_set_params(void *crt, struct CRT_MULTI *m)
+{
+    struct CRT *v = crt;
+
+    v->hue = m->hue;
+    v->brightness = m->brightness;
+    v->contrast = m->contrast;
+    v->saturation = m->saturation;
+    v->black_point = m->black_point;
+    v->white_point = m->white_point;
+    v->scanlines = m->scanlines;
+    v->blend = m->blend;
+    v->persistence = m->persistence;
+    v->field_only = m->field_only;
+}
+
+static void
+be_set_targets(void *crt, struct CRT_MULTI_TARGET *t, int n)
+{
+    crt_set_targets(crt, (struct CRT_TARGET *) t, n);
+}
+
+static void
+fill_settings(struct NTSC_SETTINGS *s, struct CRT_MULTI_SETTINGS *m)
+{
+    s->data = m->data;
+    s->w = m->w;
+    s->h = m->h;
+    s->hue = m->hue;
+    s->xoffset = m->xoffset;
+    s->yoffset = m->yoffset;
+    s->dirty = m->dirty;
+#if (CRT_SYSTEM != CRT_SYSTEM_NES)
+    s->format = m->format;
+#endif
+#if (CRT_SYSTEM != CRT_SYSTEM_NES) && (CRT_SYSTEM != CRT_SYSTEM_NESRGB)
+    s->raw = m->raw;
+    s->as_color = m->as_color;
+    s->field = m->field;
+    s->frame = m->frame;
+#endif
+#if (CRT_SYSTEM == CRT_SYSTEM_NES) || (CRT_SYSTEM == CRT_SYSTEM_NESRGB) || \
+    (CRT_SYSTEM == CRT_SYSTEM_SNES) || (CRT_SYSTEM == CRT_SYSTEM_PV1K) || \
+    (CRT_SYSTEM == CRT_SYSTEM_TEMP)
+    s->dot_crawl_offset = m->dot_crawl_offset;
+#endif
+#if (CRT_SYSTEM == CRT_SYSTEM_NES)
+    s->border_color = m->border_color;
+#endif
+#if (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
+    s->do_aberration = m->do_aberration;
+#endif
+}
+
+static void
+be_modulate(void *crt, void *ntsc, struct CRT_MULTI_SETTINGS *m)
+{
+    fill_settings(ntsc, m);
+    crt_modulate(crt, ntsc);
+}
+
+static void
+be_demodulate(void *crt, int noise)
+{
+    crt_demodulate(crt, noise);
+}
+
+static void
+be_demodulate_still(void *crt, int noise)
+{
+    crt_demodulate_still(crt, noise);
+}
+
+static void
+be_demodulate_dirty(void *crt, int noise)
+{
+    crt_demodulate_dirty(crt, noise);
+}
+
+static void
+be_demodulate_signal(void *crt, const signed char *sig, int noise)
+{
+    crt_demodulate_signal(crt, sig, noise);
+}
+
+static void
+be_stream_begin(void *crt, void *st, void *ntsc, struct CRT_MULTI_SETTINGS *m,
+                int noise, void (*rows_done)(void *ctx, int beg, int end),
+                void *ctx)
+{
+    fill_settings(ntsc, m);
+    crt_stream_begin(crt, st, ntsc, noise, rows_done, ctx);
+}
+
+static void
+be_stream_rows(void *crt, void *st, int rows)
+{
+    crt_stream_rows(crt, st, rows);
+}
+
+static void
+be_stream_end(void *crt, void *st)
+{
+    crt_stream_end(crt, st);
+}
+
+static int
+be_field_map(void *crt, int *beg, int *end)
+{
+    return crt_field_map(crt, beg, end);
+}
+
+static void
+be_fade(void *crt, int keep)
+{
+    crt_fade(crt, keep);
+}
+
+#if (CRT_SYSTEM == CRT_SYSTEM_NTSC)
+#define BE_NAME "NTSC"
+#elif (CRT_SYSTEM == CRT_SYSTEM_NES)
+#define BE_NAME "NES"
+#elif (CRT_SYSTEM == CRT_SYSTEM_PV1K)
+#define BE_NAME "PV1K"
+#elif (CRT_SYSTEM == CRT_SYSTEM_SNES)
+#define BE_NAME "SNES"
+#elif (CRT_SYSTEM == CRT_SYSTEM_TEMP)
+#define BE_NAME "TEMPLATE"
+#elif (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
+#define BE_NAME "NTSCVHS"
+#elif (CRT_SYSTEM == CRT_SYSTEM_NESRGB)
+#define BE_NAME "NESRGB"
+#endif
+
+const struct CRT_BACKEND CRT_CAT(crt_backend_, CRT_SYSTEM) = {
+    CRT_SYSTEM,
+    BE_NAME,
+    CRT_HRES, CRT_VRES, CRT_CC_SAMPLES, CRT_CC_VPER,
+    CRT_LINES,
+    be_create,
+    be_create_settings,
+    be_create_stream,
+    be_resize,
+    be_set_buffers,
+    be_set_targets,
+    be_reset,
+    be_get_params,
+    be_set_params,
+    be_modulate,
+    be_demodulate,
+    be_demodulate_still,
+    be_demodulate_dirty,
+    be_demodulate_signal,
+    be_stream_begin,
+    be_stream_rows,
+    be_stream_end,
+    be_field_map,
+    be_fade
+};
+
+#elif defined(CRT_MULTI_DISPATCH)
+
+#include <stdlib.h>
+#include <string.h>
+#include "crt_multi.h"
+
+extern const struct CRT_BACKEND crt_backend_0;
+extern const struct CRT_BACKEND crt_backend_1;
+extern const struct CRT_BACKEND crt_backend_2;
+extern const struct CRT_BACKEND crt_backend_3;
+extern const struct CRT_BACKEND crt_backend_4;
+extern const struct CRT_BACKEND crt_backend_5;
+extern const struct CRT_BACKEND crt_backend_6;
+
+/* indexed by CRT_SYSTEM */
+static const struct CRT_BACKEND *backends[CRT_MULTI_NSYSTEMS] = {
+    &crt_backend_0,
+    &crt_backend_1,
+    &crt_backend_2,
+    &crt_backend_3,
+    &crt_backend_4,
+    &crt_backend_5,
+    &crt_backend_6
+};
+
+extern int
+crt_multi_init(struct CRT_MULTI *m, int system,
+               int w, int h, int f, unsigned char *out)
+{
+    memset(m, 0, sizeof(struct CRT_MULTI));
+    if (system < 0 || system >= CRT_MULTI_NSYSTEMS) {
+        return 0;
+    }
+    m->be = backends[system];
+    m->crt = m->be->create(w, h, f, out);
+    m->ntsc = m->be->create_settings();
+    m->stream = m->be->create_stream();
+    if (m->crt == NULL || m->ntsc == NULL || m->stream == NULL) {
+        crt_multi_free(m);
+        return 0;
+    }
+    m->be->get_params(m->crt, m);
+    return 1;
+}
+
+extern void
+crt_multi_free(struct CRT_MULTI *m)
+{
+    free(m->crt);
+    free(m->ntsc);
+    free(m->stream);
+    m->crt = NULL;
+    m->ntsc = NULL;
+    m->stream = NULL;
+    m->be = NULL;
+}
+
+extern void
+crt_multi_resize(struct CRT_MULTI *m, int w, int h, int f, unsigned char *out)
+{
+    m->be->resize(m->crt, w, h, f, out);
+}
+
+extern void
+crt_multi_set_buffers(struct CRT_MULTI *m, signed char *analog,
+                      signed char *inp)
+{
+    m->be->set_buffers(m->crt, analog, inp);
+}
+
+extern void
+crt_multi_set_targets(struct CRT_MULTI *m, struct CRT_MULTI_TARGET *t, int n)
+{
+    m->be->set_targets(m->crt, t, n);
+}
+
+extern void
+crt_multi_reset(struct CRT_MULTI *m)
+{
+    m->be->set_params(m->crt, m);
+    m->be->reset(m->crt);
+    m->be->get_params(m->crt, m);
+}
+
+extern void
+crt_multi_modulate(struct CRT_MULTI *m, struct CRT_MULTI_SETTINGS *s)
+{
+    m->be->set_params(m->crt, m);
+    m->be->modulate(m->crt, m->ntsc, s);
+}
+
+extern void
+crt_multi_demodulate(struct CRT_MULTI *m, int noise)
+{
+    m->be->set_params(m->crt, m);
+    m->be->demodulate(m->crt, noise);
+}
+
+extern void
+crt_multi_demodulate_still(struct CRT_MULTI *m, int noise)
+{
+    m->be->set_params(m->crt, m);
+    m->be->demodulate_still(m->crt, noise);
+}
+
+extern void
+crt_multi_demodulate_dirty(struct CRT_MULTI *m, int noise)
+{
+    m->be->set_params(m->crt, m);
+    m->be->demodulate_dirty(m->crt, noise);
+}
+
+extern void
+crt_multi_demodulate_signal(struct CRT_MULTI *m, const signed char *sig,
+                            int noise)
+{
+    m->be->set_params(m->crt, m);
+    m->be->demodulate_signal(m->crt, sig, noise);
+}
+
+extern void
+crt_multi_stream_begin(struct CRT_MULTI *m, struct CRT_MULTI_SETTINGS *s,
+                       int noise,
+                       void (*rows_done)(void *ctx, int beg, int end),
+                       void *ctx)
+{
+    m->be->set_params(m->crt, m);
+    m->be->stream_begin(m->crt, m->stream, m->ntsc, s, noise, rows_done, ctx);
+}
+
+extern void
+crt_multi_stream_rows(struct CRT_MULTI *m, int rows)
+{
+    m->be->stream_rows(m->crt, m->stream, rows);
+}
+
+extern void
+crt_multi_stream_end(struct CRT_MULTI *m)
+{
+    m->be->stream_end(m->crt, m->stream);
+}
+
+extern int
+crt_multi_field_map(struct CRT_MULTI *m, int *beg, int *end)
+{
+    m->be->set_params(m->crt, m);
+    return m->be->field_map(m->crt, beg, end);
+}
+
+extern void
+crt_multi_fade(struct CRT_MULTI *m, int keep)
+{
+    m->be->set_params(m->crt, m);
+    m->be->fade(m->crt, keep);
+}
+
+extern const char *
+crt_multi_name(int system)
+{
+    if (system < 0 || system >= CRT_MULTI_NSYSTEMS) {
+        return NULL;
+    }
+    return backends[system]->name;
+}
+
+#else
+
+/* a translation unit can't be empty */
+typedef int crt_multi_unused;
+
+#endif
@@ -0,0 +1,221 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#ifndef _CRT_MULTI_H_
+#define _CRT_MULTI_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* crt_multi.h
+ *
+ * Every CRT_SYSTEM in one program, picked at runtime.
+ *
+ * Normally the system is chosen at compile time (CRT_SYSTEM in crt_core.h).
+ * This API instead links in one copy of the library per system, each one
+ * compiled with its own CRT_SYSTEM so all of its constants (CRT_HRES,
+ * CRT_VRES, CRT_CC_SAMPLES, CRT_CC_VPER, ...) are still known at compile time
+ * in its inner loops, and dispatches to the one chosen in crt_multi_init().
+ *
+ * Build it with CMake (-DCRT_MULTI=on makes the crt_multi library) or by
+ * hand, every system needs its own set of objects:
+ *
+ *   cc -O3 -DCRT_MULTI_DISPATCH -c crt_multi.c
+ *   for n in 0 1 2 3 4 5 6:
+ *     cc -O3 -DCRT_MULTI_BACKEND -DCRT_SYSTEM=n -c crt_core.c crt_ntsc.c
+ *        crt_nes.c crt_pv1k.c crt_template.c crt_snes.c crt_ntscvhs.c
+ *        crt_nesrgb.c crt_multi.c          (into a separate directory each)
+ *
+ * A program using this API should only include crt_multi.h, not crt_core.h
+ */
+
+#define CRT_SYSTEM_NTSC     0 /* standard NTSC */
+#define CRT_SYSTEM_NES      1 /* decode 6 or 9-bit NES pixels */
+#define CRT_SYSTEM_PV1K     2 /* Casio PV-1000 */
+#define CRT_SYSTEM_SNES     3 /* SNES - uses RGB */
+#define CRT_SYSTEM_TEMP     4 /* template implementation */
+#define CRT_SYSTEM_NTSCVHS  5 /* standard NTSC VHS */
+#define CRT_SYSTEM_NESRGB   6 /* encode RGB image with NES artifacts */
+#define CRT_MULTI_NSYSTEMS  7
+
+/* same as in crt_core.h */
+#define CRT_PIX_FORMAT_RGB  0  /* 3 bytes per pixel [R,G,B,R,G,B,R,G,B...] */
+#define CRT_PIX_FORMAT_BGR  1  /* 3 bytes per pixel [B,G,R,B,G,R,B,G,R...] */
+#define CRT_PIX_FORMAT_ARGB 2  /* 4 bytes per pixel [A,R,G,B,A,R,G,B...]   */
+#define CRT_PIX_FORMAT_RGBA 3  /* 4 bytes per pixel [R,G,B,A,R,G,B,A...]   */
+#define CRT_PIX_FORMAT_ABGR 4  /* 4 bytes per pixel [A,B,G,R,A,B,G,R...]   */
+#define CRT_PIX_FORMAT_BGRA 5  /* 4 bytes per pixel [B,G,R,A,B,G,R,A...]   */
+
+/* the settings of every system's NTSC_SETTINGS in one struct,
+ * each system only uses the ones that it has (see crt_<system>.h)
+ */
+struct CRT_MULTI_SETTINGS {
+    const void *data; /* image data (unsigned short NES pixels for NES) */
+    int format;       /* pix format (one of the CRT_PIX_FORMATs) */
+    int w, h;         /* width and height of image */
+    int raw;          /* 0 = scale image to fit monitor, 1 = don't scale */
+    int as_color;     /* 0 = monochrome, 1 = full color */
+    int field;        /* 0 = even, 1 = odd */
+    int frame;        /* 0 = even, 1 = odd */
+    int hue;          /* 0-359 */
+    int xoffset;      /* x offset in sample space. 0 is minimum value */
+    int yoffset;      /* y offset in # of lines. 0 is minimum value */
+    int dot_crawl_offset; /* NES, NESRGB, SNES, PV1K, TEMP */
+    unsigned int border_color; /* NES */
+    int do_aberration; /* NTSCVHS */
+    const unsigned char *dirty; /* changed rows (see NTSC_SETTINGS), or NULL */
+};
+
+/* same as struct CRT_TARGET in crt_core.h */
+#define CRT_MULTI_MAX_TARGETS 8
+struct CRT_MULTI_TARGET {
+    int w, h; /* width/height */
+    int format; /* pixel format (one of the CRT_PIX_FORMATs) */
+    int pitch; /* bytes per row, 0 = w * bytes per pixel */
+    unsigned char *out; /* image data */
+};
+
+struct CRT_MULTI;
+
+/* one compiled copy of the library (internal) */
+struct CRT_BACKEND {
+    int system;
+    const char *name;
+    /* the compile-time constants of this system */
+    int hres, vres, cc_samples, cc_vper;
+    int lines; /* CRT_LINES */
+
+    void *(*create)(int w, int h, int f, unsigned char *out);
+    void *(*create_settings)(void);
+    void *(*create_stream)(void);
+    void (*resize)(void *crt, int w, int h, int f, unsigned char *out);
+    void (*set_buffers)(void *crt, signed char *analog, signed char *inp);
+    void (*set_targets)(void *crt, struct CRT_MULTI_TARGET *t, int n);
+    void (*reset)(void *crt);
+    void (*get_params)(void *crt, struct CRT_MULTI *m);
+    void (*set_params)(void *crt, struct CRT_MULTI *m);
+    void (*modulate)(void *crt, void *ntsc, struct CRT_MULTI_SETTINGS *s);
+    void (*demodulate)(void *crt, int noise);
+    void (*demodulate_still)(void *crt, int noise);
+    void (*demodulate_dirty)(void *crt, int noise);
+    void (*demodulate_signal)(void *crt, const signed char *sig, int noise);
+    void (*stream_begin)(void *crt, void *st, void *ntsc,
+                         struct CRT_MULTI_SETTINGS *s, int noise,
+                         void (*rows_done)(void *ctx, int beg, int end),
+                         void *ctx);
+    void (*stream_rows)(void *crt, void *st, int rows);
+    void (*stream_end)(void *crt, void *st);
+    int (*field_map)(void *crt, int *beg, int *end);
+    void (*fade)(void *crt, int keep);
+};
+
+struct CRT_MULTI {
+    const struct CRT_BACKEND *be;
+    void *crt;  /* the system's struct CRT */
+    void *ntsc; /* the system's struct NTSC_SETTINGS */
+    void *stream; /* the system's struct CRT_STREAM */
+
+    /* common monitor settings, same as in struct CRT.
+     * these get passed on to the system's CRT on every update */
+    int hue, brightness, contrast, saturation;
+    int black_point, white_point;
+    int scanlines; /* leave gaps between lines if necessary */
+    int blend; /* blend new field onto previous image */
+    int persistence; /* 0-256 share of the previous image kept by blending */
+    int field_only; /* one output row per line, see crt_multi_field_map() */
+};
+
+/* Initializes the library for one system.
+ *   system - one of the CRT_SYSTEMs
+ *   w      - width of the output image
+ *   h      - height of the output image
+ *   f      - format of the output image
+ *   out    - pointer to output image data
+ *
+ * returns 0 if the system does not exist or there is not enough memory
+ */
+extern int crt_multi_init(struct CRT_MULTI *m, int system,
+                          int w, int h, int f, unsigned char *out);
+
+/* Frees everything allocated by crt_multi_init() */
+extern void crt_multi_free(struct CRT_MULTI *m);
+
+/* Updates the output image parameters
+ *   w   - width of the output image
+ *   h   - height of the output image
+ *   f   - format of the output image
+ *   out - pointer to output image data
+ */
+extern void crt_multi_resize(struct CRT_MULTI *m, int w, int h, int f,
+                             unsigned char *out);
+
+/* Same as crt_set_buffers(), the buffers are be->hres * be->vres samples */
+extern void crt_multi_set_buffers(struct CRT_MULTI *m, signed char *analog,
+                                  signed char *inp);
+
+/* Same as crt_set_targets(), at most CRT_MULTI_MAX_TARGETS are used */
+extern void crt_multi_set_targets(struct CRT_MULTI *m,
+                                  struct CRT_MULTI_TARGET *t, int n);
+
+/* Resets the CRT settings back to their defaults */
+extern void crt_multi_reset(struct CRT_MULTI *m);
+
+/* Modulates an image into an analog NTSC signal
+ *   s - struct containing settings to apply to this field
+ */
+extern void crt_multi_modulate(struct CRT_MULTI *m,
+                               struct CRT_MULTI_SETTINGS *s);
+
+/* Demodulates the NTSC signal generated by crt_multi_modulate()
+ *   noise - the amount of noise added to the signal (0 - inf)
+ */
+extern void crt_multi_demodulate(struct CRT_MULTI *m, int noise);
+
+/* Same as crt_demodulate_still() */
+extern void crt_multi_demodulate_still(struct CRT_MULTI *m, int noise);
+
+/* Same as crt_demodulate_dirty() */
+extern void crt_multi_demodulate_dirty(struct CRT_MULTI *m, int noise);
+
+/* Same as crt_demodulate_signal() */
+extern void crt_multi_demodulate_signal(struct CRT_MULTI *m,
+                                        const signed char *sig, int noise);
+
+/* Same as crt_stream_begin(), the stream state is kept in m so only one
+ * field can be streamed at a time. s is copied, but the image it points to
+ * is read as the rows come in
+ */
+extern void crt_multi_stream_begin(struct CRT_MULTI *m,
+                                   struct CRT_MULTI_SETTINGS *s, int noise,
+                                   void (*rows_done)(void *ctx,
+                                                     int beg, int end),
+                                   void *ctx);
+
+/* Same as crt_stream_rows() */
+extern void crt_multi_stream_rows(struct CRT_MULTI *m, int rows);
+
+/* Same as crt_stream_end() */
+extern void crt_multi_stream_end(struct CRT_MULTI *m);
+
+/* Same as crt_field_map(), beg and end need be->lines entries each */
+extern int crt_multi_field_map(struct CRT_MULTI *m, int *beg, int *end);
+
+/* Same as crt_fade() */
+extern void crt_multi_fade(struct CRT_MULTI *m, int keep);
+
+/* Get the name of a system, NULL if it does not exist */
+extern const char *crt_multi_name(int system);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
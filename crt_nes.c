@@ -68,12 +68,82 @@ square_sample(int p, int phase)
  */
 #define NES_BORDER    0
 
+/* rebuild the source column/row tables if the image geometry changed */
+static void
+update_resample(struct NTSC_SETTINGS *s, int destw, int desth)
+{
+    int i;
+    
+    if (s->rs_w == s->w && s->rs_h == s->h &&
+        s->rs_destw == destw && s->rs_desth == desth) {
+        return;
+    }
+    for (i = 0; i < destw; i++) {
+        s->rs_col[i] = (i * s->w) / destw;
+    }
+    for (i = 0; i < desth; i++) {
+        s->rs_row[i] = (i * s->h) / desth;
+    }
+    s->rs_w = s->w;
+    s->rs_h = s->h;
+    s->rs_destw = destw;
+    s->rs_desth = desth;
+}
+
+/* if nothing but the image changed since the last update, only its dirty
+ * rows have to be modulated again (returns 1 then)
+ */
+static int
+dirty_rows_only(struct CRT *v, struct NTSC_SETTINGS *s, int *key)
+{
+    int same;
+    
+    same = (s->dirty != NULL) && (s->dl_data == (const void *) s->data) &&
+           (memcmp(key, s->dl_key, sizeof(s->dl_key)) == 0);
+    memcpy(s->dl_key, key, sizeof(s->dl_key));
+    s->dl_data = s->data;
+    if (!same) {
+        /* every line gets rewritten */
+        memset(v->changed, 1, sizeof(v->changed));
+    }
+    return same;
+}
+
 /* the optimized version is NOT the most optimized version, it just performs
  * some simple refactoring to prevent a few redundant computations
  */
 #if NES_OPTIMIZED
 
 
+/* a sample only depends on the 9-bit pixel and the phase (mod 12), so all
+ * of them get computed once
+ */
+static void
+update_square(struct CRT *v, struct NTSC_SETTINGS *s)
+{
+    int p, ph;
+    
+    if (s->sq_valid && s->sq_black == v->black_point &&
+        s->sq_white == v->white_point) {
+        return;
+    }
+    for (p = 0; p < 512; p++) {
+        for (ph = 0; ph < 12; ph++) {
+            int ire;
+            
+            ire = BLACK_LEVEL + v->black_point;
+            ire += square_sample(p, ph + 0);
+            ire += square_sample(p, ph + 1);
+            ire += square_sample(p, ph + 2);
+            ire += square_sample(p, ph + 3);
+            s->sq_tab[p][ph] = (ire * v->white_point / 100) >> 12;
+        }
+    }
+    s->sq_black = v->black_point;
+    s->sq_white = v->white_point;
+    s->sq_valid = 1;
+}
+
 /* this function is an optimization
  * basically factoring out the field setup since as long as CRT->analog
  * does not get cleared, all of this should remain the same every update
@@ -107,6 +177,7 @@ extern void
 crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
 {
     int x, y, xo, yo;
+    int key[DL_KEYS], partial;
     int destw = AV_LEN;
     int desth = CRT_LINES;
     int n, phase;
@@ -114,10 +185,15 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     int ccburst[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for burst */
     int sn, cs;
     static int phasetab[CRT_CC_VPER] = { 0, 4, 8 };
+#if CRT_DO_STATS
+    long st;
+#endif
         
-    if (!s->field_initialized) {
+    CRT_STAT_BEG(st);
+    if (!v->fld_valid) {
         setup_field(v);
-        s->field_initialized = 1;
+        s->dl_data = NULL; /* redo all of the active video */
+        v->fld_valid = 1;
     }
 
     for (y = 0; y < CRT_CC_VPER; y++) {
@@ -129,12 +205,28 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         }
     }
 
+    update_resample(s, destw, desth);
+    update_square(v, s);
     xo = AV_BEG  + s->xoffset;
     yo = CRT_TOP + s->yoffset;
          
     /* align signal */
     xo = (xo & ~3);
     
+    memset(key, 0, sizeof(key));
+    key[0] = xo;
+    key[1] = yo;
+    key[2] = destw;
+    key[3] = desth;
+    key[4] = s->w;
+    key[5] = s->h;
+    key[6] = s->hue;
+    key[7] = s->dot_crawl_offset;
+    key[8] = (int) s->border_color;
+    key[9] = v->black_point;
+    key[10] = v->white_point;
+    partial = dirty_rows_only(v, s, key);
+    
 #if NES_BORDER
     for (n = CRT_TOP; n <= (CRT_BOT + 2); n++) {
         int t; /* time */
@@ -145,27 +237,29 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         phase = phasetab[(n + s->dot_crawl_offset) % CRT_CC_VPER] + 6;
         t = LAV_BEG;
         while (t < CRT_HRES) {
-            int ire, p;
-            p = s->border_color;
+            int p;
+            p = s->border_color & 0x1ff;
             if (t == LAV_BEG) p = 0xf0;
-            ire = BLACK_LEVEL + v->black_point;
-            ire += square_sample(p, phase + 0);
-            ire += square_sample(p, phase + 1);
-            ire += square_sample(p, phase + 2);
-            ire += square_sample(p, phase + 3);
-            ire = (ire * v->white_point / 100) >> 12;
-            line[t++] = ire;
+            line[t++] = s->sq_tab[p][phase % 12];
             phase += 3;
         }
     }
 #endif
+    CRT_STAT_LAP(v, blank, st);
     for (y = 0; y < desth; y++) {
         signed char *line;  
+        const signed char *sq;
         int t, cb;
-        int sy = (y * s->h) / desth;
+        int sy = s->rs_row[y];
         
         if (sy >= s->h) sy = s->h;
         if (sy < 0) sy = 0;
+        if (partial) {
+            if (sy < s->h && !s->dirty[sy]) {
+                continue;
+            }
+            v->changed[y + yo] = 1;
+        }
  
         n = (y + yo);
         line = &v->analog[n * CRT_HRES];
@@ -176,28 +270,32 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
             line[t] = (BLANK_LEVEL + (cb * BURST_LEVEL)) >> 5;
             iccf[n % CRT_CC_VPER][t % CRT_CC_SAMPLES] = line[t];
         }
+        CRT_STAT_LAP(v, sync, st);
         sy *= s->w;
         phase = phasetab[(y + yo + s->dot_crawl_offset) % CRT_CC_VPER];
+        line += xo;
+        sq = &s->sq_tab[0][0];
         for (x = 0; x < destw; x++) {
-            int ire, p;
-            
-            p = s->data[((x * s->w) / destw) + sy];
-            ire = BLACK_LEVEL + v->black_point;
-            ire += square_sample(p, phase + 0);
-            ire += square_sample(p, phase + 1);
-            ire += square_sample(p, phase + 2);
-            ire += square_sample(p, phase + 3);
-            ire = (ire * v->white_point / 100) >> 12;
-            v->analog[(x + xo) + (y + yo) * CRT_HRES] = ire;
+            line[x] = sq[(s->data[s->rs_col[x] + sy] & 0x1ff) * 12 + phase];
             phase += 3;
+            if (phase >= 12) {
+                phase -= 12;
+            }
         }
+        CRT_STAT_LAP(v, active, st);
     }
     
     for (n = 0; n < CRT_CC_VPER; n++) {
         for (x = 0; x < CRT_CC_SAMPLES; x++) {
+            if (partial) {
+                /* skipped rows did not fill in iccf */
+                iccf[n][x] = (BLANK_LEVEL + (ccburst[n][x] * BURST_LEVEL)) >> 5;
+            }
             v->ccf[n][x] = iccf[n][x] << 7;
         }
     }
+    CRT_STAT_LAP(v, active, st);
+    CRT_STAT_ADD(v, modulated, 1);
 }
 #else
 /* NOT NES_OPTIMIZED */
@@ -205,6 +303,7 @@ extern void
 crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
 {
     int x, y, xo, yo;
+    int key[DL_KEYS], partial;
     int destw = AV_LEN;
     int desth = CRT_LINES;
     int n, phase;
@@ -212,7 +311,11 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     int ccburst[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for burst */
     int sn, cs;
     static int phasetab[CRT_CC_VPER] = { 0, 4, 8 };
+#if CRT_DO_STATS
+    long st;
+#endif
 
+    CRT_STAT_BEG(st);
     for (y = 0; y < CRT_CC_VPER; y++) {
         xo = (y + s->dot_crawl_offset) * (360 / CRT_CC_VPER);
         for (x = 0; x < CRT_CC_SAMPLES; x++) {
@@ -222,12 +325,28 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         }
     }
 
+    update_resample(s, destw, desth);
     xo = AV_BEG  + s->xoffset;
     yo = CRT_TOP + s->yoffset;
      
     /* align signal */
     xo = (xo & ~3);
     
+    memset(key, 0, sizeof(key));
+    key[0] = xo;
+    key[1] = yo;
+    key[2] = destw;
+    key[3] = desth;
+    key[4] = s->w;
+    key[5] = s->h;
+    key[6] = s->hue;
+    key[7] = s->dot_crawl_offset;
+    key[8] = (int) s->border_color;
+    key[9] = v->black_point;
+    key[10] = v->white_point;
+    partial = dirty_rows_only(v, s, key);
+    
+    CRT_STAT_LAP(v, blank, st);
     for (n = 0; n < CRT_VRES; n++) {
         int t; /* time */
         signed char *line = &v->analog[n * CRT_HRES];
@@ -277,17 +396,24 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         }
     }
 
+    CRT_STAT_LAP(v, sync, st);
     for (y = 0; y < desth; y++) {
-        int sy = (y * s->h) / desth;
+        int sy = s->rs_row[y];
         if (sy >= s->h) sy = s->h;
         if (sy < 0) sy = 0;
+        if (partial) {
+            if (sy < s->h && !s->dirty[sy]) {
+                continue;
+            }
+            v->changed[y + yo] = 1;
+        }
         
         sy *= s->w;
         phase = phasetab[(y + yo + s->dot_crawl_offset) % CRT_CC_VPER];
         for (x = 0; x < destw; x++) {
             int ire, p;
             
-            p = s->data[((x * s->w) / destw) + sy];
+            p = s->data[s->rs_col[x] + sy];
             ire = BLACK_LEVEL + v->black_point;
             ire += square_sample(p, phase + 0);
             ire += square_sample(p, phase + 1);
@@ -304,6 +430,8 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
             v->ccf[n][x] = iccf[n][x] << 7;
         }
     }
+    CRT_STAT_LAP(v, active, st);
+    CRT_STAT_ADD(v, modulated, 1);
 }
 #endif
 
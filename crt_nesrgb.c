@@ -46,10 +46,52 @@ setup_field(struct CRT *v)
     }
 }
  
+/* rebuild the source column/row tables if the image geometry changed */
+static void
+update_resample(struct NTSC_SETTINGS *s, int destw, int desth)
+{
+    int i;
+    
+    if (s->rs_w == s->w && s->rs_h == s->h &&
+        s->rs_destw == destw && s->rs_desth == desth) {
+        return;
+    }
+    for (i = 0; i < destw; i++) {
+        s->rs_col[i] = (i * s->w) / destw;
+    }
+    for (i = 0; i < desth; i++) {
+        s->rs_row[i] = (i * s->h) / desth;
+    }
+    s->rs_w = s->w;
+    s->rs_h = s->h;
+    s->rs_destw = destw;
+    s->rs_desth = desth;
+}
+
+/* if nothing but the image changed since the last update, only its dirty
+ * rows have to be modulated again (returns 1 then)
+ */
+static int
+dirty_rows_only(struct CRT *v, struct NTSC_SETTINGS *s, int *key)
+{
+    int same;
+    
+    same = (s->dirty != NULL) && (s->dl_data == (const void *) s->data) &&
+           (memcmp(key, s->dl_key, sizeof(s->dl_key)) == 0);
+    memcpy(s->dl_key, key, sizeof(s->dl_key));
+    s->dl_data = s->data;
+    if (!same) {
+        /* every line gets rewritten */
+        memset(v->changed, 1, sizeof(v->changed));
+    }
+    return same;
+}
+
 extern void
 crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
 {
     int x, y, xo, yo;
+    int key[DL_KEYS], partial;
     int destw = AV_LEN;
     int desth = CRT_LINES;
     int n;
@@ -58,11 +100,16 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     int ccmodQ[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for mod */
     int ccburst[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for burst */
     int sn, cs;
-    int bpp;
+    int bpp, ro, go, bo; /* bytes per pixel, channel offsets */
+#if CRT_DO_STATS
+    long st;
+#endif
         
-    if (!s->field_initialized) {
+    CRT_STAT_BEG(st);
+    if (!v->fld_valid) {
         setup_field(v);
-        s->field_initialized = 1;
+        s->dl_data = NULL; /* redo all of the active video */
+        v->fld_valid = 1;
     }
 
     for (y = 0; y < CRT_CC_VPER; y++) {
@@ -78,24 +125,47 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         }
     }
 
-    bpp = crt_bpp4fmt(s->format);
+    bpp = crt_offsets4fmt(s->format, &ro, &go, &bo);
     if (bpp == 0) {
         return; /* just to be safe */
     }
     
+    update_resample(s, destw, desth);
     xo = AV_BEG  + s->xoffset;
     yo = CRT_TOP + s->yoffset;
          
     /* align signal */
     xo = (xo & ~3);
     
+    memset(key, 0, sizeof(key));
+    key[0] = xo;
+    key[1] = yo;
+    key[2] = destw;
+    key[3] = desth;
+    key[4] = s->w;
+    key[5] = s->h;
+    key[6] = s->format;
+    key[7] = s->hue;
+    key[8] = s->dot_crawl_offset;
+    key[9] = v->black_point;
+    key[10] = v->white_point;
+    partial = dirty_rows_only(v, s, key);
+    
+    CRT_STAT_LAP(v, blank, st);
     for (y = 0; y < desth; y++) {
         signed char *line;  
         int t, cb;
-        int sy = (y * s->h) / desth;
+        int sy = s->rs_row[y];
+        int col = -1, cy = 0, ci = 0, cq = 0; /* last converted pixel */
         
         if (sy >= s->h) sy = s->h;
         if (sy < 0) sy = 0;
+        if (partial) {
+            if (sy < s->h && !s->dirty[sy]) {
+                continue;
+            }
+            v->changed[y + yo] = 1;
+        }
  
         n = (y + yo);
         line = &v->analog[n * CRT_HRES];
@@ -107,6 +177,7 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
             line[t] = (BLANK_LEVEL + (cb * BURST_LEVEL)) >> 5;
             iccf[n][t % CRT_CC_SAMPLES] = line[t];
         }
+        CRT_STAT_LAP(v, sync, st);
         sy *= s->w;
         for (x = 0; x < destw; x++) {
             int fy, fi, fq;
@@ -115,39 +186,22 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
             int ire; /* composite signal */
             int xoff;
             
-            pix = s->data + ((((x * s->w) / destw) + sy) * bpp);
-            switch (s->format) {
-                case CRT_PIX_FORMAT_RGB:
-                case CRT_PIX_FORMAT_RGBA:
-                    rA = pix[0];
-                    gA = pix[1];
-                    bA = pix[2];
-                    break;
-                case CRT_PIX_FORMAT_BGR: 
-                case CRT_PIX_FORMAT_BGRA:
-                    rA = pix[2];
-                    gA = pix[1];
-                    bA = pix[0];
-                    break;
-                case CRT_PIX_FORMAT_ARGB:
-                    rA = pix[1];
-                    gA = pix[2];
-                    bA = pix[3];
-                    break;
-                case CRT_PIX_FORMAT_ABGR:
-                    rA = pix[3];
-                    gA = pix[2];
-                    bA = pix[1];
-                    break;
-                default:
-                    rA = gA = bA = 0;
-                    break;
+            if (s->rs_col[x] != col) {
+                /* upscaled images repeat source pixels, only convert once */
+                col = s->rs_col[x];
+                pix = s->data + ((col + sy) * bpp);
+                rA = pix[ro];
+                gA = pix[go];
+                bA = pix[bo];
+
+                /* RGB to YIQ */
+                cy = (19595 * rA + 38470 * gA +  7471 * bA) >> 14;
+                ci = (39059 * rA - 18022 * gA - 21103 * bA) >> 14;
+                cq = (13894 * rA - 34275 * gA + 20382 * bA) >> 14;
             }
-            
-            /* RGB to YIQ */
-            fy = (19595 * rA + 38470 * gA +  7471 * bA) >> 14;
-            fi = (39059 * rA - 18022 * gA - 21103 * bA) >> 14;
-            fq = (13894 * rA - 34275 * gA + 20382 * bA) >> 14;
+            fy = cy;
+            fi = ci;
+            fq = cq;
             ire = BLACK_LEVEL + v->black_point;
             
             xoff = (x + xo) % CRT_CC_SAMPLES;
@@ -160,13 +214,20 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
             
             v->analog[(x + xo) + (y + yo) * CRT_HRES] = ire;
         }
+        CRT_STAT_LAP(v, active, st);
     }
     
     for (n = 0; n < CRT_CC_VPER; n++) {
         for (x = 0; x < CRT_CC_SAMPLES; x++) {
+            if (partial) {
+                /* skipped rows did not fill in iccf */
+                iccf[n][x] = (BLANK_LEVEL + (ccburst[n][x] * BURST_LEVEL)) >> 5;
+            }
             v->ccf[n][x] = iccf[n][x] << 7;
         }
     }
+    CRT_STAT_LAP(v, active, st);
+    CRT_STAT_ADD(v, modulated, 1);
 }
 
 #endif
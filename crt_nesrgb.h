@@ -129,6 +129,9 @@ extern "C" {
 #define BLANK_LEVEL      0
 #define SYNC_LEVEL      -37
 
+/* number of settings that go into the active video besides the image */
+#define DL_KEYS          16
+
 struct NTSC_SETTINGS {
     const unsigned char *data; /* image data */
     int format;     /* pix format (one of the CRT_PIX_FORMATs in crt_core.h) */
@@ -138,8 +141,19 @@ struct NTSC_SETTINGS {
     int hue;              /* 0-359 */
     int xoffset;    /* x offset in sample space. 0 is minimum value */
     int yoffset;    /* y offset in # of lines. 0 is minimum value */
+    /* optional, one flag per image row that is nonzero if the row changed
+     * since the last update. if nothing else changed, only those rows get
+     * modulated again. NULL = every row */
+    const unsigned char *dirty;
     /* make sure your NTSC_SETTINGS struct is zeroed out before you do anything */
-    int field_initialized; /* internal state */
+    /* source column/row for each output sample/line, rebuilt only when
+     * the geometry changes (internal state) */
+    int rs_w, rs_h, rs_destw, rs_desth;
+    int rs_col[AV_LEN];
+    int rs_row[CRT_LINES];
+    /* what the active video was made from last time (internal state) */
+    const void *dl_data;
+    int dl_key[DL_KEYS];
 };
 
 #ifdef __cplusplus
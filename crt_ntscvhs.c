@@ -22,6 +22,10 @@
 #define CC_PHASE(ln)     (1)
 #endif
 
+/* largest number of lines at the bottom of the field that can be hit by
+ * the head switching aberration, see crt_modulate() */
+#define ABERRATION_MAX   ((11 - 8) + 14)
+
 #define EXP_P         11
 #define EXP_ONE       (1 << EXP_P)
 #define EXP_MASK      (EXP_ONE - 1)
@@ -86,12 +90,6 @@ expx(int n)
 /********************************* FILTERS ***********************************/
 /*****************************************************************************/
 
-/* infinite impulse response low pass filter for bandlimiting YIQ */
-static struct IIRLP {
-    int c;
-    int h; /* history */
-} iirY, iirI, iirQ;
-
 /* freq  - total bandwidth
  * limit - max frequency
  */
@@ -125,10 +123,201 @@ iirf(struct IIRLP *f, int s)
 #endif
 }
 
+/* per NTSC_SETTINGS generator for the aberration, unlike rand() it is the
+ * same on every platform and thread. returns 0 to 32767
+ */
+static int
+vhs_rand(int *seed)
+{
+    *seed = (int) ((unsigned) *seed * 214019u + 140327895u);
+    return (*seed >> 16) & 0x7fff;
+}
+
+/* this function is an optimization
+ * basically factoring out the field setup since as long as CRT->analog
+ * does not get cleared and the active video area stays in the same place,
+ * the equalizing pulses and the blanking/sync of the video lines remain the
+ * same every update
+ */
+static void
+setup_field(struct CRT *v)
+{
+    int n;
+
+    for (n = 0; n < CRT_VRES; n++) {
+        int t; /* time */
+        signed char *line = &v->analog[n * CRT_HRES];
+        
+        t = LINE_BEG;
+
+        if (n <= 3 || (n >= 7 && n <= 9)) {
+            /* equalizing pulses - small blips of sync, mostly blank */
+            while (t < (4   * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+            while (t < (50  * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+            while (t < (54  * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+            while (t < (100 * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+        } else if (!(n >= 4 && n <= 6)) {
+            /* video line */
+            while (t < SYNC_BEG) line[t++] = BLANK_LEVEL; /* FP */
+            while (t < BW_BEG)   line[t++] = SYNC_LEVEL;  /* SYNC */
+            while (t < AV_BEG)   line[t++] = BLANK_LEVEL; /* BW + CB + BP */
+
+            if (n < CRT_TOP) {
+                while (t < CRT_HRES) line[t++] = BLANK_LEVEL;
+            }
+        }
+    }
+}
+
+/* rebuild the source column/row tables if the image geometry changed */
+static void
+update_resample(struct NTSC_SETTINGS *s, int destw, int desth)
+{
+    int i;
+    
+    if (s->rs_w == s->w && s->rs_h == s->h &&
+        s->rs_destw == destw && s->rs_desth == desth) {
+        return;
+    }
+    for (i = 0; i < destw; i++) {
+        s->rs_col[i] = (i * s->w) / destw;
+    }
+    for (i = 0; i < desth; i++) {
+        s->rs_row[i] = (i * s->h) / desth;
+    }
+    s->rs_w = s->w;
+    s->rs_h = s->h;
+    s->rs_destw = destw;
+    s->rs_desth = desth;
+}
+
+/* if nothing but the image changed since the last update, only its dirty
+ * rows have to be modulated again (returns 1 then)
+ */
+static int
+dirty_rows_only(struct CRT *v, struct NTSC_SETTINGS *s, int *key)
+{
+    int same;
+    
+    same = (s->dirty != NULL) && (s->dl_data == (const void *) s->data) &&
+           (memcmp(key, s->dl_key, sizeof(s->dl_key)) == 0);
+    memcpy(s->dl_key, key, sizeof(s->dl_key));
+    s->dl_data = s->data;
+    if (!same) {
+        /* every line gets rewritten */
+        memset(v->changed, 1, sizeof(v->changed));
+    }
+    return same;
+}
+
+/* what the active video of a line is modulated with */
+struct MOD_LINE {
+    struct NTSC_SETTINGS *s;
+    int bpp, ro, go, bo; /* bytes per pixel, channel offsets */
+    int destw;           /* samples of active video */
+    int xoff;            /* color carrier phase of the first sample */
+    int black, white;    /* black level, scale of the YIQ signal */
+    int modI[CRT_CC_SAMPLES]; /* color carrier, line phase included */
+    int modQ[CRT_CC_SAMPLES];
+};
+
+/* RGB to YIQ */
+#define MOD_PIXEL(pix)                                                         \
+    do {                                                                       \
+        int rA = (pix)[ro], gA = (pix)[go], bA = (pix)[bo];                    \
+                                                                               \
+        cy = (19595 * rA + 38470 * gA +  7471 * bA) >> 14;                     \
+        ci = (39059 * rA - 18022 * gA - 21103 * bA) >> 14;                     \
+        cq = (13894 * rA - 34275 * gA + 20382 * bA) >> 14;                     \
+    } while (0)
+
+/* bandlimit Y,I,Q and modulate the pixel into the next sample */
+#define MOD_SAMPLE()                                                           \
+    do {                                                                       \
+        int fy, fi, fq, ire;                                                   \
+                                                                               \
+        fy = iirf(&iY, cy);                                                    \
+        fi = iirf(&iI, ci) * modI[xoff] >> 4;                                  \
+        fq = iirf(&iQ, cq) * modQ[xoff] >> 4;                                  \
+        if (++xoff == CRT_CC_SAMPLES) {                                        \
+            xoff = 0;                                                          \
+        }                                                                      \
+        ire = black + ((fy + fi + fq) * white >> 10);                          \
+        if (ire < 0)   ire = 0;                                                \
+        if (ire > 110) ire = 110;                                              \
+        *out++ = ire;                                                          \
+    } while (0)
+
+/* the filters are copied so they can stay in registers */
+#define MOD_LOCALS                                                             \
+    struct IIRLP iY = m->s->iirY, iI = m->s->iirI, iQ = m->s->iirQ;            \
+    const int *modI = m->modI, *modQ = m->modQ;                                \
+    int bpp = m->bpp, ro = m->ro, go = m->go, bo = m->bo;                      \
+    int black = m->black, white = m->white, xoff = m->xoff;                    \
+    int cy = 0, ci = 0, cq = 0
+
+/* any scale, through the resample table */
+static void
+mod_row_scaled(struct MOD_LINE *m, const unsigned char *row, signed char *out)
+{
+    MOD_LOCALS;
+    const int *rs_col = m->s->rs_col;
+    int x, destw = m->destw, col = -1; /* last converted pixel */
+    
+    for (x = 0; x < destw; x++) {
+        if (rs_col[x] != col) {
+            /* upscaled images repeat source pixels, only convert once */
+            col = rs_col[x];
+            MOD_PIXEL(row + col * bpp);
+        }
+        MOD_SAMPLE();
+    }
+}
+
+/* REP samples for every source pixel, the image is walked straight through */
+#define DEFINE_MOD_ROW(name, REP)                                              \
+static void                                                                    \
+name(struct MOD_LINE *m, const unsigned char *row, signed char *out)           \
+{                                                                              \
+    MOD_LOCALS;                                                                \
+    const unsigned char *end = row + m->s->w * bpp;                            \
+    int k;                                                                     \
+                                                                               \
+    for (; row < end; row += bpp) {                                            \
+        MOD_PIXEL(row);                                                        \
+        for (k = 0; k < (REP); k++) {                                          \
+            MOD_SAMPLE();                                                      \
+        }                                                                      \
+    }                                                                          \
+}
+
+DEFINE_MOD_ROW(mod_row_1x, 1)
+DEFINE_MOD_ROW(mod_row_2x, 2)
+DEFINE_MOD_ROW(mod_row_3x, 3)
+DEFINE_MOD_ROW(mod_row_4x, 4)
+
+typedef void (*MOD_ROW_FUNC)(struct MOD_LINE *, const unsigned char *,
+                             signed char *);
+
+/* raw 1:1 and integer scales get their own kernels */
+static MOD_ROW_FUNC
+mod_row_func(int w, int destw)
+{
+    static const MOD_ROW_FUNC fn[] = {
+        mod_row_scaled, mod_row_1x, mod_row_2x, mod_row_3x, mod_row_4x
+    };
+    
+    if (w <= 0 || (destw % w) != 0 || (destw / w) > 4) {
+        return mod_row_scaled;
+    }
+    return fn[destw / w];
+}
+
 extern void
 crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
 {
     int x, y, xo, yo;
+    int key[DL_KEYS], partial;
     int destw = AV_LEN;
     int desth = ((CRT_LINES * 64500) >> 16);
     int iccf[CRT_CC_SAMPLES];
@@ -137,13 +326,20 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     int ccburst[CRT_CC_SAMPLES]; /* color phase for burst */
     int sn, cs, n, ph;
     int inv_phase = 0;
-    int bpp;
+    int field_offset;
+    int bpp, ro, go, bo; /* bytes per pixel, channel offsets */
     int aberration = 0;
+    struct MOD_LINE m;
+    MOD_ROW_FUNC mod_row;
+#if CRT_DO_STATS
+    long st;
+#endif
 
+    CRT_STAT_BEG(st);
     if (!s->iirs_initialized) {
-        init_iir(&iirY, L_FREQ, Y_FREQ);
-        init_iir(&iirI, L_FREQ, I_FREQ);
-        init_iir(&iirQ, L_FREQ, Q_FREQ);
+        init_iir(&s->iirY, L_FREQ, Y_FREQ);
+        init_iir(&s->iirI, L_FREQ, I_FREQ);
+        init_iir(&s->iirQ, L_FREQ, Q_FREQ);
         s->iirs_initialized = 1;
     }
 #if CRT_DO_BLOOM
@@ -188,10 +384,11 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         memset(ccmodQ, 0, sizeof(ccmodQ));
     }
     
-    bpp = crt_bpp4fmt(s->format);
+    bpp = crt_offsets4fmt(s->format, &ro, &go, &bo);
     if (bpp == 0) {
         return; /* just to be safe */
     }
+    update_resample(s, destw, desth);
     xo = AV_BEG  + s->xoffset + (AV_LEN    - destw) / 2;
     yo = CRT_TOP + s->yoffset + (CRT_LINES - desth) / 2;
     
@@ -203,8 +400,38 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     /* align signal */
     xo = (xo & ~3);
     if (s->do_aberration) {
-        aberration = ((rand() % 12) - 8) + 14;
+        aberration = ((vhs_rand(&s->rn) % 12) - 8) + 14;
+    }
+    if (!v->fld_valid ||
+        v->fld_xo != xo || v->fld_yo != yo ||
+        v->fld_w != destw || v->fld_h != desth) {
+        /* analog is new or active video moved, it may have been drawn
+         * over the blanking */
+        setup_field(v);
+        s->dl_data = NULL; /* redo all of the active video */
+        v->fld_valid = 1;
+        v->fld_xo = xo;
+        v->fld_yo = yo;
+        v->fld_w = destw;
+        v->fld_h = desth;
     }
+    memset(key, 0, sizeof(key));
+    key[0] = xo;
+    key[1] = yo;
+    key[2] = destw;
+    key[3] = desth;
+    key[4] = s->w;
+    key[5] = s->h;
+    key[6] = s->format;
+    key[7] = s->field;
+    key[8] = s->frame;
+    key[9] = s->hue;
+    key[10] = s->as_color;
+    key[11] = v->black_point;
+    key[12] = v->white_point;
+    partial = dirty_rows_only(v, s, key);
+
+    CRT_STAT_LAP(v, blank, st);
     for (n = 0; n < CRT_VRES; n++) {
         int t; /* time */
         signed char *line = &v->analog[n * CRT_HRES];
@@ -212,11 +439,8 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         t = LINE_BEG;
 
         if (n <= 3 || (n >= 7 && n <= 9)) {
-            /* equalizing pulses - small blips of sync, mostly blank */
-            while (t < (4   * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (50  * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
-            while (t < (54  * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (100 * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+            /* built by setup_field() */
+            continue;
         } else if (n >= 4 && n <= 6) {
             int even[4] = { 46, 50, 96, 100 };
             int odd[4] =  { 4, 50, 96, 100 };
@@ -231,17 +455,18 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
             while (t < (offs[3] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
         } else {
             int cb;
-            if (n < (CRT_VRES - aberration)) {
-                /* video line */
-                while (t < SYNC_BEG) line[t++] = BLANK_LEVEL; /* FP */
-                while (t < BW_BEG)   line[t++] = SYNC_LEVEL;  /* SYNC */
+            
+            if (n >= (CRT_VRES - ABERRATION_MAX)) {
+                /* the bottom lines lose their sync depending on the
+                 * aberration so they have to be redone every field */
+                if (n < (CRT_VRES - aberration)) {
+                    while (t < SYNC_BEG) line[t++] = BLANK_LEVEL; /* FP */
+                    while (t < BW_BEG)   line[t++] = SYNC_LEVEL;  /* SYNC */
+                }
+                while (t < BW_BEG)   line[t++] = BLANK_LEVEL;
+                v->changed[n] = 1;
             }
-            while (t < AV_BEG)   line[t++] = BLANK_LEVEL; /* BW + CB + BP */
 
-            if (n < CRT_TOP) {
-                while (t < CRT_HRES) line[t++] = BLANK_LEVEL;
-            }
-         
             /* CB_CYCLES of color burst at 3.579545 Mhz */
             for (t = CB_BEG; t < CB_BEG + (CB_CYCLES * CRT_CB_FREQ); t++) {
 #if (CRT_CHROMA_PATTERN == 1)
@@ -258,81 +483,51 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     /* reset hsync every frame so only the bottom part is warped */
     v->hsync = 0;
 
+    field_offset = (s->field * s->h + desth) / desth / 2;
+    m.s = s;
+    m.bpp = bpp;
+    m.ro = ro;
+    m.go = go;
+    m.bo = bo;
+    m.destw = destw;
+    m.xoff = xo % CRT_CC_SAMPLES;
+    m.black = BLACK_LEVEL + v->black_point;
+    m.white = WHITE_LEVEL * v->white_point / 100;
+    for (x = 0; x < CRT_CC_SAMPLES; x++) {
+        m.modI[x] = ph * ccmodI[x];
+        m.modQ[x] = ph * ccmodQ[x];
+    }
+    mod_row = mod_row_func(s->w, destw);
+    CRT_STAT_LAP(v, sync, st);
     for (y = 0; y < desth; y++) {
-        int field_offset;
         int sy;
         
-        field_offset = (s->field * s->h + desth) / desth / 2;
-        sy = (y * s->h) / desth;
+        sy = s->rs_row[y];
     
         sy += field_offset;
 
         if (sy >= s->h) sy = s->h;
+        if (partial) {
+            if (sy < s->h && !s->dirty[sy]) {
+                continue;
+            }
+            v->changed[y + yo] = 1;
+        }
         
         sy *= s->w;
         
-        reset_iir(&iirY);
-        reset_iir(&iirI);
-        reset_iir(&iirQ);
+        reset_iir(&s->iirY);
+        reset_iir(&s->iirI);
+        reset_iir(&s->iirQ);
         
-        for (x = 0; x < destw; x++) {
-            int fy, fi, fq;
-            int rA, gA, bA;
-            const unsigned char *pix;
-            int ire; /* composite signal */
-            int xoff;
-            
-            pix = s->data + ((((x * s->w) / destw) + sy) * bpp);
-            switch (s->format) {
-                case CRT_PIX_FORMAT_RGB:
-                case CRT_PIX_FORMAT_RGBA:
-                    rA = pix[0];
-                    gA = pix[1];
-                    bA = pix[2];
-                    break;
-                case CRT_PIX_FORMAT_BGR: 
-                case CRT_PIX_FORMAT_BGRA:
-                    rA = pix[2];
-                    gA = pix[1];
-                    bA = pix[0];
-                    break;
-                case CRT_PIX_FORMAT_ARGB:
-                    rA = pix[1];
-                    gA = pix[2];
-                    bA = pix[3];
-                    break;
-                case CRT_PIX_FORMAT_ABGR:
-                    rA = pix[3];
-                    gA = pix[2];
-                    bA = pix[1];
-                    break;
-                default:
-                    rA = gA = bA = 0;
-                    break;
-            }
-
-            /* RGB to YIQ */
-            fy = (19595 * rA + 38470 * gA +  7471 * bA) >> 14;
-            fi = (39059 * rA - 18022 * gA - 21103 * bA) >> 14;
-            fq = (13894 * rA - 34275 * gA + 20382 * bA) >> 14;
-            ire = BLACK_LEVEL + v->black_point;
-            
-            xoff = (x + xo) % CRT_CC_SAMPLES;
-            /* bandlimit Y,I,Q */
-            fy = iirf(&iirY, fy);
-            fi = iirf(&iirI, fi) * ph * ccmodI[xoff] >> 4;
-            fq = iirf(&iirQ, fq) * ph * ccmodQ[xoff] >> 4;
-            ire += (fy + fi + fq) * (WHITE_LEVEL * v->white_point / 100) >> 10;
-            if (ire < 0)   ire = 0;
-            if (ire > 110) ire = 110;
-
-            v->analog[(x + xo) + (y + yo) * CRT_HRES] = ire;
-        }
+        mod_row(&m, s->data + sy * bpp, v->analog + xo + (y + yo) * CRT_HRES);
     }
     for (n = 0; n < CRT_CC_VPER; n++) {
         for (x = 0; x < CRT_CC_SAMPLES; x++) {
             v->ccf[n][x] = 0;
         }
     }
+    CRT_STAT_LAP(v, active, st);
+    CRT_STAT_ADD(v, modulated, 1);
 }
 #endif
@@ -130,6 +130,15 @@ extern "C" {
 #define BLANK_LEVEL      0
 #define SYNC_LEVEL      -40
 
+/* infinite impulse response low pass filter for bandlimiting YIQ */
+struct IIRLP {
+    int c;
+    int h; /* history */
+};
+
+/* number of settings that go into the active video besides the image */
+#define DL_KEYS          16
+
 struct NTSC_SETTINGS {
     const unsigned char *data; /* image data */
     int format;     /* pix format (one of the CRT_PIX_FORMATs in crt_core.h) */
@@ -142,8 +151,24 @@ struct NTSC_SETTINGS {
     int xoffset;    /* x offset in sample space. 0 is minimum value */
     int yoffset;    /* y offset in # of lines. 0 is minimum value */
     int do_aberration; /* 0 = no aberration, 1 = with aberration */
+    int rn; /* seed for the 'random' aberration, can be set to reseed it */
+    /* optional, one flag per image row that is nonzero if the row changed
+     * since the last update. if nothing else changed, only those rows get
+     * modulated again. NULL = every row */
+    const unsigned char *dirty;
     /* make sure your NTSC_SETTINGS struct is zeroed out before you do anything */
     int iirs_initialized; /* internal state */
+    struct IIRLP iirY, iirI, iirQ; /* internal state */
+    /* the blanking is only built once, set this back to 0 if CRT->analog
+     * gets cleared or the NTSC_SETTINGS start being used with another CRT */
+    /* source column/row for each output sample/line, rebuilt only when
+     * the geometry changes (internal state) */
+    int rs_w, rs_h, rs_destw, rs_desth;
+    int rs_col[AV_LEN];
+    int rs_row[CRT_LINES];
+    /* what the active video was made from last time (internal state) */
+    const void *dl_data;
+    int dl_key[DL_KEYS];
 };
 
 #ifdef __cplusplus
@@ -79,12 +79,6 @@ expx(int n)
 /********************************* FILTERS ***********************************/
 /*****************************************************************************/
 
-/* infinite impulse response low pass filter for bandlimiting YIQ */
-static struct IIRLP {
-    int c;
-    int h; /* history */
-} iirY, iirI, iirQ;
-
 /* freq  - total bandwidth
  * limit - max frequency
  */
@@ -122,10 +116,206 @@ iirf(struct IIRLP *f, int s)
 #endif
 }
 
+/* this function is an optimization
+ * basically factoring out the field setup since as long as CRT->analog
+ * does not get cleared and the active video area stays in the same place,
+ * the equalizing pulses and the blanking/sync of the video lines remain the
+ * same every update
+ */
+static void
+setup_field(struct CRT *v)
+{
+    int n;
+
+    for (n = 0; n < CRT_VRES; n++) {
+        int t; /* time */
+        signed char *line = &v->analog[n * CRT_HRES];
+        
+        t = LINE_BEG;
+
+        if ((n >= EQU_REGION_A_LO && n <= EQU_REGION_A_HI) ||
+            (n >= EQU_REGION_B_LO && n <= EQU_REGION_B_HI)) {
+            /* equalizing pulses - small blips of sync, mostly blank */
+            while (t < (4   * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+            while (t < (50  * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+            while (t < (54  * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+            while (t < (100 * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+        } else if (n >= SYNC_REGION_LO && n <= SYNC_REGION_HI) {
+            int even[4] = { 46, 50, 96, 100 };
+            int *offs = even;
+            /* vertical sync pulse - small blips of blank, mostly sync */
+            while (t < (offs[0] * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+            while (t < (offs[1] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+            while (t < (offs[2] * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
+            while (t < (offs[3] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+        } else {
+            /* video line */
+            while (t < SYNC_BEG) line[t++] = BLANK_LEVEL; /* FP */
+            while (t < BW_BEG)   line[t++] = SYNC_LEVEL;  /* SYNC */
+            while (t < AV_BEG)   line[t++] = BLANK_LEVEL; /* BW + CB + BP */
+            if (n < CRT_TOP) {
+                while (t < CRT_HRES) line[t++] = BLANK_LEVEL;
+            }
+        }
+    }
+}
+
+/* rebuild the source column/row tables if the image geometry changed */
+static void
+update_resample(struct NTSC_SETTINGS *s, int destw, int desth)
+{
+    int i;
+    
+    if (s->rs_w == s->w && s->rs_h == s->h &&
+        s->rs_destw == destw && s->rs_desth == desth) {
+        return;
+    }
+    for (i = 0; i < destw; i++) {
+        s->rs_col[i] = (i * s->w) / destw;
+    }
+    for (i = 0; i < desth; i++) {
+        s->rs_row[i] = (i * s->h) / desth;
+    }
+    s->rs_w = s->w;
+    s->rs_h = s->h;
+    s->rs_destw = destw;
+    s->rs_desth = desth;
+}
+
+/* if nothing but the image changed since the last update, only its dirty
+ * rows have to be modulated again (returns 1 then)
+ */
+static int
+dirty_rows_only(struct CRT *v, struct NTSC_SETTINGS *s, int *key)
+{
+    int same;
+    
+    same = (s->dirty != NULL) && (s->dl_data == (const void *) s->data) &&
+           (memcmp(key, s->dl_key, sizeof(s->dl_key)) == 0);
+    memcpy(s->dl_key, key, sizeof(s->dl_key));
+    s->dl_data = s->data;
+    if (!same) {
+        /* every line gets rewritten */
+        memset(v->changed, 1, sizeof(v->changed));
+    }
+    return same;
+}
+
+/* what the active video of a line is modulated with */
+struct MOD_LINE {
+    struct NTSC_SETTINGS *s;
+    int bpp, ro, go, bo; /* bytes per pixel, channel offsets */
+    int destw;           /* samples of active video */
+    int xoff;            /* color carrier phase of the first sample */
+    int black, white;    /* black level, scale of the YIQ signal */
+    const int *modI;     /* color carrier of the line */
+    const int *modQ;
+};
+
+/* RGB to YIQ matrix in 16.16 fixed point format */
+static const int yiqmat[9] = {
+    19595,  38470,  7471,   /* Y */
+    39059, -18022, -21103,  /* I */
+    13894, -34275,  20382,  /* Q */
+};
+
+/* RGB to YIQ */
+#define MOD_PIXEL(pix)                                                         \
+    do {                                                                       \
+        int rA = (pix)[ro], gA = (pix)[go], bA = (pix)[bo];                    \
+                                                                               \
+        cy = (yiqmat[0] * rA + yiqmat[1] * gA + yiqmat[2] * bA) >> 14;         \
+        ci = (yiqmat[3] * rA + yiqmat[4] * gA + yiqmat[5] * bA) >> 14;         \
+        cq = (yiqmat[6] * rA + yiqmat[7] * gA + yiqmat[8] * bA) >> 14;         \
+    } while (0)
+
+/* bandlimit Y,I,Q and modulate the pixel into the next sample */
+#define MOD_SAMPLE()                                                           \
+    do {                                                                       \
+        int fy, fi, fq, ire;                                                   \
+                                                                               \
+        fy = iirf(&iY, cy);                                                    \
+        fi = iirf(&iI, ci) * modI[xoff] >> 4;                                  \
+        fq = iirf(&iQ, cq) * modQ[xoff] >> 4;                                  \
+        if (++xoff == CRT_CC_SAMPLES) {                                        \
+            xoff = 0;                                                          \
+        }                                                                      \
+        ire = black + ((fy + fi + fq) * white >> 10);                          \
+        if (ire < IRE_MIN) ire = IRE_MIN;                                      \
+        if (ire > IRE_MAX) ire = IRE_MAX;                                      \
+        *out++ = ire;                                                          \
+    } while (0)
+
+/* the filters are copied so they can stay in registers */
+#define MOD_LOCALS                                                             \
+    struct IIRLP iY = m->s->iirY, iI = m->s->iirI, iQ = m->s->iirQ;            \
+    const int *modI = m->modI, *modQ = m->modQ;                                \
+    int bpp = m->bpp, ro = m->ro, go = m->go, bo = m->bo;                      \
+    int black = m->black, white = m->white, xoff = m->xoff;                    \
+    int cy = 0, ci = 0, cq = 0
+
+/* any scale, through the resample table */
+static void
+mod_row_scaled(struct MOD_LINE *m, const unsigned char *row, signed char *out)
+{
+    MOD_LOCALS;
+    const int *rs_col = m->s->rs_col;
+    int x, destw = m->destw, col = -1; /* last converted pixel */
+    
+    for (x = 0; x < destw; x++) {
+        if (rs_col[x] != col) {
+            /* upscaled images repeat source pixels, only convert once */
+            col = rs_col[x];
+            MOD_PIXEL(row + col * bpp);
+        }
+        MOD_SAMPLE();
+    }
+}
+
+/* REP samples for every source pixel, the image is walked straight through */
+#define DEFINE_MOD_ROW(name, REP)                                              \
+static void                                                                    \
+name(struct MOD_LINE *m, const unsigned char *row, signed char *out)           \
+{                                                                              \
+    MOD_LOCALS;                                                                \
+    const unsigned char *end = row + m->s->w * bpp;                            \
+    int k;                                                                     \
+                                                                               \
+    for (; row < end; row += bpp) {                                            \
+        MOD_PIXEL(row);                                                        \
+        for (k = 0; k < (REP); k++) {                                          \
+            MOD_SAMPLE();                                                      \
+        }                                                                      \
+    }                                                                          \
+}
+
+DEFINE_MOD_ROW(mod_row_1x, 1)
+DEFINE_MOD_ROW(mod_row_2x, 2)
+DEFINE_MOD_ROW(mod_row_3x, 3)
+DEFINE_MOD_ROW(mod_row_4x, 4)
+
+typedef void (*MOD_ROW_FUNC)(struct MOD_LINE *, const unsigned char *,
+                             signed char *);
+
+/* raw 1:1 and integer scales get their own kernels */
+static MOD_ROW_FUNC
+mod_row_func(int w, int destw)
+{
+    static const MOD_ROW_FUNC fn[] = {
+        mod_row_scaled, mod_row_1x, mod_row_2x, mod_row_3x, mod_row_4x
+    };
+    
+    if (w <= 0 || (destw % w) != 0 || (destw / w) > 4) {
+        return mod_row_scaled;
+    }
+    return fn[destw / w];
+}
+
 extern void
 crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
 {
     int x, y, xo, yo;
+    int key[DL_KEYS], partial;
     int destw = AV_LEN;
     int desth = ((CRT_LINES * 64500) >> 16);
     int iccf[CRT_CC_VPER][CRT_CC_SAMPLES];
@@ -133,12 +323,18 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     int ccmodQ[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for mod */
     int ccburst[CRT_CC_VPER][CRT_CC_SAMPLES]; /* color phase for burst */
     int sn, cs, n, ph;
-    int bpp;
+    int bpp, ro, go, bo; /* bytes per pixel, channel offsets */
+    struct MOD_LINE m;
+    MOD_ROW_FUNC mod_row;
+#if CRT_DO_STATS
+    long st;
+#endif
 
+    CRT_STAT_BEG(st);
     if (!s->iirs_initialized) {
-        init_iir(&iirY, L_FREQ, Y_FREQ);
-        init_iir(&iirI, L_FREQ, I_FREQ);
-        init_iir(&iirQ, L_FREQ, Q_FREQ);
+        init_iir(&s->iirY, L_FREQ, Y_FREQ);
+        init_iir(&s->iirI, L_FREQ, I_FREQ);
+        init_iir(&s->iirQ, L_FREQ, Q_FREQ);
         s->iirs_initialized = 1;
     }
 #if CRT_DO_BLOOM
@@ -187,10 +383,11 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         memset(ccmodQ, 0, sizeof(ccmodQ));
     }
     
-    bpp = crt_bpp4fmt(s->format);
+    bpp = crt_offsets4fmt(s->format, &ro, &go, &bo);
     if (bpp == 0) {
         return; /* just to be safe */
     }
+    update_resample(s, destw, desth);
     xo = AV_BEG  + s->xoffset + (AV_LEN    - destw) / 2;
     yo = CRT_TOP + s->yoffset + (CRT_LINES - desth) / 2;
     
@@ -200,6 +397,37 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
     /* align signal */
     xo = xo - (xo % CRT_CC_SAMPLES);
     
+    if (!v->fld_valid ||
+        v->fld_xo != xo || v->fld_yo != yo ||
+        v->fld_w != destw || v->fld_h != desth) {
+        /* analog is new or active video moved, it may have been drawn
+         * over the blanking */
+        setup_field(v);
+        s->dl_data = NULL; /* redo all of the active video */
+        v->fld_valid = 1;
+        v->fld_xo = xo;
+        v->fld_yo = yo;
+        v->fld_w = destw;
+        v->fld_h = desth;
+    }
+    memset(key, 0, sizeof(key));
+    key[0] = xo;
+    key[1] = yo;
+    key[2] = destw;
+    key[3] = desth;
+    key[4] = s->w;
+    key[5] = s->h;
+    key[6] = s->format;
+    key[7] = s->field;
+    key[8] = s->frame;
+    key[9] = s->hue;
+    key[10] = s->as_color;
+    key[11] = s->dot_crawl_offset;
+    key[12] = v->black_point;
+    key[13] = v->white_point;
+    partial = dirty_rows_only(v, s, key);
+
+    CRT_STAT_LAP(v, blank, st);
     for (n = 0; n < CRT_VRES; n++) {
         int t; /* time */
         signed char *line = &v->analog[n * CRT_HRES];
@@ -207,31 +435,13 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         t = LINE_BEG;
 
         if ((n >= EQU_REGION_A_LO && n <= EQU_REGION_A_HI) ||
-            (n >= EQU_REGION_B_LO && n <= EQU_REGION_B_HI)) {
-            /* equalizing pulses - small blips of sync, mostly blank */
-            while (t < (4   * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (50  * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
-            while (t < (54  * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (100 * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
-        } else if (n >= SYNC_REGION_LO && n <= SYNC_REGION_HI) {
-            int even[4] = { 46, 50, 96, 100 };
-            int *offs = even;
-            /* vertical sync pulse - small blips of blank, mostly sync */
-            while (t < (offs[0] * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (offs[1] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
-            while (t < (offs[2] * CRT_HRES / 100)) line[t++] = SYNC_LEVEL;
-            while (t < (offs[3] * CRT_HRES / 100)) line[t++] = BLANK_LEVEL;
+            (n >= EQU_REGION_B_LO && n <= EQU_REGION_B_HI) ||
+            (n >= SYNC_REGION_LO && n <= SYNC_REGION_HI)) {
+            /* built by setup_field() */
+            continue;
         } else {
             int cb;
 
-            /* video line */
-            while (t < SYNC_BEG) line[t++] = BLANK_LEVEL; /* FP */
-            while (t < BW_BEG)   line[t++] = SYNC_LEVEL;  /* SYNC */
-            while (t < AV_BEG)   line[t++] = BLANK_LEVEL; /* BW + CB + BP */
-            if (n < CRT_TOP) {
-                while (t < CRT_HRES) line[t++] = BLANK_LEVEL;
-            }
-
             /* CB_CYCLES of color burst */
             for (t = CB_BEG; t < CB_BEG + (CB_CYCLES * CRT_CB_FREQ); t++) {
                 cb = ccburst[n % CRT_CC_VPER][t % CRT_CC_SAMPLES];
@@ -241,81 +451,41 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
         }
     }
 
+    m.s = s;
+    m.bpp = bpp;
+    m.ro = ro;
+    m.go = go;
+    m.bo = bo;
+    m.destw = destw;
+    m.xoff = xo % CRT_CC_SAMPLES;
+    m.black = BLACK_LEVEL + v->black_point;
+    m.white = WHITE_LEVEL * v->white_point / 100;
+    mod_row = mod_row_func(s->w, destw);
+    CRT_STAT_LAP(v, sync, st);
     for (y = 0; y < desth; y++) {
         int sy;
         
-        sy = (y * s->h) / desth;
+        sy = s->rs_row[y];
     
 
         if (sy >= s->h) sy = s->h;
+        if (partial) {
+            if (sy < s->h && !s->dirty[sy]) {
+                continue;
+            }
+            v->changed[y + yo] = 1;
+        }
         
         sy *= s->w;
         
-        reset_iir(&iirY);
-        reset_iir(&iirI);
-        reset_iir(&iirQ);
+        reset_iir(&s->iirY);
+        reset_iir(&s->iirI);
+        reset_iir(&s->iirQ);
         
         ph = (y + yo) % CRT_CC_VPER;
-        
-        for (x = 0; x < destw; x++) {
-            int fy, fi, fq;
-            int rA, gA, bA;
-            const unsigned char *pix;
-            int ire; /* composite signal */
-            int xoff;
-            /* RGB to YIQ matrix in 16.16 fixed point format */
-            static int yiqmat[9] = {
-                19595,  38470,  7471,   /* Y */
-                39059, -18022, -21103,  /* I */
-                13894, -34275,  20382,  /* Q */
-            };
-            pix = s->data + ((((x * s->w) / destw) + sy) * bpp);
-            switch (s->format) {
-                case CRT_PIX_FORMAT_RGB:
-                case CRT_PIX_FORMAT_RGBA:
-                    rA = pix[0];
-                    gA = pix[1];
-                    bA = pix[2];
-                    break;
-                case CRT_PIX_FORMAT_BGR: 
-                case CRT_PIX_FORMAT_BGRA:
-                    rA = pix[2];
-                    gA = pix[1];
-                    bA = pix[0];
-                    break;
-                case CRT_PIX_FORMAT_ARGB:
-                    rA = pix[1];
-                    gA = pix[2];
-                    bA = pix[3];
-                    break;
-                case CRT_PIX_FORMAT_ABGR:
-                    rA = pix[3];
-                    gA = pix[2];
-                    bA = pix[1];
-                    break;
-                default:
-                    rA = gA = bA = 0;
-                    break;
-            }
-
-            /* RGB to YIQ */
-            fy = (yiqmat[0] * rA + yiqmat[1] * gA + yiqmat[2] * bA) >> 14;
-            fi = (yiqmat[3] * rA + yiqmat[4] * gA + yiqmat[5] * bA) >> 14;
-            fq = (yiqmat[6] * rA + yiqmat[7] * gA + yiqmat[8] * bA) >> 14;
-            ire = BLACK_LEVEL + v->black_point;
-            
-            xoff = (x + xo) % CRT_CC_SAMPLES;
-            /* bandlimit Y,I,Q */
-            fy = iirf(&iirY, fy);
-            fi = iirf(&iirI, fi) * ccmodI[ph][xoff] >> 4;
-            fq = iirf(&iirQ, fq) * ccmodQ[ph][xoff] >> 4;
-            /* modulate as (Y + sin(x) * I + cos(x) * Q) */
-            ire += (fy + fi + fq) * (WHITE_LEVEL * v->white_point / 100) >> 10;
-            if (ire < IRE_MIN) ire = IRE_MIN;
-            if (ire > IRE_MAX) ire = IRE_MAX;
-
-            v->analog[(x + xo) + (y + yo) * CRT_HRES] = ire;
-        }
+        m.modI = ccmodI[ph];
+        m.modQ = ccmodQ[ph];
+        mod_row(&m, s->data + sy * bpp, v->analog + xo + (y + yo) * CRT_HRES);
     }
 
     for (n = 0; n < CRT_CC_VPER; n++) {
@@ -323,5 +493,7 @@ crt_modulate(struct CRT *v, struct NTSC_SETTINGS *s)
             v->ccf[n][x] = iccf[n][x] << 7;
         }
     }
+    CRT_STAT_LAP(v, active, st);
+    CRT_STAT_ADD(v, modulated, 1);
 }
 #endif
@@ -0,0 +1,307 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "crt_core.h"
+
+/* Benchmark for crt_modulate() / crt_demodulate() without any file I/O.
+ *
+ * Compile it for the system you want to measure (CRT_SYSTEM) using:
+ * cc -O3 -o crt_bench crt_bench.c crt_core.c crt_ntsc.c crt_nes.c crt_pv1k.c crt_template.c crt_snes.c crt_ntscvhs.c crt_nesrgb.c
+ *
+ * ./crt_bench [seconds per test]
+ *
+ * every test emulates fields of a synthetic test pattern until the time is
+ * up and prints the average cost of one field:
+ *   fields/s   - full fields (modulate + demodulate) per second
+ *   mod ns/smp - crt_modulate() time per sample of the analog signal
+ *   dem ns/smp - crt_demodulate() time per sample of the analog signal
+ *   dem ns/px  - crt_demodulate() time per output pixel
+ *
+ * compiled with -DCRT_DO_STATS=1 every test also prints where the time went
+ * (see crt_get_stats()), in microseconds per field
+ *
+ * before that it checks that streaming a field (crt_stream_begin()) gives
+ * the same image as modulating and demodulating all of it, and exits with
+ * a failure if it doesn't
+ */
+
+#define DRV_HEADER "NTSC/CRT v%d.%d.%d by EMMIR 2018-2023\n",\
+                    CRT_MAJOR, CRT_MINOR, CRT_PATCH
+
+#define IMG_W 256
+#define IMG_H 240
+
+static const char *sysnames[] = {
+    "NTSC", "NES", "PV1K", "SNES", "TEMPLATE", "NTSCVHS", "NESRGB"
+};
+
+static const int sizes[][2] = {
+    { 640, 480 },
+    { 1280, 960 },
+    { 1920, 1440 }
+};
+
+static struct CRT crt, scrt;
+static struct NTSC_SETTINGS ntsc, sntsc;
+
+#if (CRT_SYSTEM == CRT_SYSTEM_NES)
+static unsigned short img[IMG_W * IMG_H];
+
+/* NES palette color bars on top of a ramp of all the palette entries */
+static void
+make_pattern(void)
+{
+    int x, y;
+
+    for (y = 0; y < IMG_H; y++) {
+        for (x = 0; x < IMG_W; x++) {
+            int p;
+            if (y < (IMG_H * 2 / 3)) {
+                p = 0x20 + (x * 13 / IMG_W);
+            } else {
+                p = ((x / 4) + (y * 64 / IMG_H)) & 0x3f;
+            }
+            /* some emphasis bits too */
+            img[x + y * IMG_W] = p | ((y & 0x30) << 3);
+        }
+    }
+}
+#else
+static unsigned char img[IMG_W * IMG_H * 4];
+
+/* SMPTE-ish color bars, a luma ramp, and fine detail for the filters */
+static void
+make_pattern(void)
+{
+    static const int bars[7] = {
+        0xc0c0c0, 0xc0c000, 0x00c0c0, 0x00c000, 0xc000c0, 0xc00000, 0x0000c0
+    };
+    int x, y;
+
+    for (y = 0; y < IMG_H; y++) {
+        for (x = 0; x < IMG_W; x++) {
+            unsigned char *p = img + (x + y * IMG_W) * 4;
+            int c;
+            if (y < (IMG_H * 2 / 3)) {
+                c = bars[x * 7 / IMG_W];
+            } else if (y < (IMG_H * 5 / 6)) {
+                c = (x * 255 / (IMG_W - 1)) * 0x010101;
+            } else {
+                c = ((x ^ y) & 1) ? 0xffffff : ((x * y) & 0xff) << 8;
+            }
+            p[0] = c >> 16 & 0xff;
+            p[1] = c >>  8 & 0xff;
+            p[2] = c >>  0 & 0xff;
+            p[3] = 0xff;
+        }
+    }
+}
+#endif
+
+static void
+setup(int w, int h, unsigned char *out, int blend)
+{
+    crt_init(&crt, w, h, CRT_PIX_FORMAT_RGBA, out);
+    crt.blend = blend;
+    crt.scanlines = 1;
+
+    memset(&ntsc, 0, sizeof(ntsc));
+    ntsc.data = (void *) img;
+    ntsc.w = IMG_W;
+    ntsc.h = IMG_H;
+#if (CRT_SYSTEM != CRT_SYSTEM_NES)
+    ntsc.format = CRT_PIX_FORMAT_RGBA;
+#endif
+#if (CRT_SYSTEM != CRT_SYSTEM_NES) && (CRT_SYSTEM != CRT_SYSTEM_NESRGB)
+    ntsc.as_color = 1;
+    ntsc.raw = 0;
+#endif
+}
+
+/* advance s to the next field like a real video source would */
+static void
+next_field_of(struct NTSC_SETTINGS *s, int n)
+{
+#if (CRT_SYSTEM == CRT_SYSTEM_NES) || (CRT_SYSTEM == CRT_SYSTEM_NESRGB) || \
+    (CRT_SYSTEM == CRT_SYSTEM_SNES) || (CRT_SYSTEM == CRT_SYSTEM_PV1K) || \
+    (CRT_SYSTEM == CRT_SYSTEM_TEMP)
+    s->dot_crawl_offset = (s->dot_crawl_offset + 1) % CRT_CC_VPER;
+#endif
+#if (CRT_SYSTEM != CRT_SYSTEM_NES) && (CRT_SYSTEM != CRT_SYSTEM_NESRGB)
+    s->field = n & 1;
+    s->frame = (n >> 1) & 1;
+#else
+    (void) s;
+    (void) n;
+#endif
+}
+
+static void
+next_field(int n)
+{
+    next_field_of(&ntsc, n);
+}
+
+/* streams fields a few rows at a time on a second CRT and compares it with
+ * the whole field path, returns 0 if any field came out different
+ */
+static int
+check_stream(int w, int h, int noise, unsigned char *out, unsigned char *sout)
+{
+    struct CRT_STREAM st;
+    int n, r, same = 1;
+
+    setup(w, h, out, 1);
+#if (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
+    ntsc.do_aberration = 1;
+#endif
+    sntsc = ntsc;
+    crt_init(&scrt, w, h, CRT_PIX_FORMAT_RGBA, sout);
+    scrt.blend = crt.blend;
+    scrt.scanlines = crt.scanlines;
+    for (n = 0; n < 8; n++) {
+        next_field(n);
+        next_field_of(&sntsc, n);
+        crt_modulate(&crt, &ntsc);
+        crt_demodulate(&crt, noise);
+
+        crt_stream_begin(&scrt, &st, &sntsc, noise, NULL, NULL);
+        for (r = 7; r < IMG_H; r += 7) {
+            crt_stream_rows(&scrt, &st, r);
+        }
+        crt_stream_end(&scrt, &st);
+        if (memcmp(out, sout, (size_t) w * h * 4) != 0) {
+            same = 0;
+        }
+    }
+    printf("streaming %dx%d, noise %d: %s\n", w, h, noise,
+           same ? "same as whole fields" : "DIFFERENT from whole fields");
+    return same;
+}
+
+#if CRT_DO_STATS
+static void
+print_stats(int n)
+{
+    struct CRT_STATS st;
+    double us = 1e6 / CRT_STATS_HZ / n;
+    
+    crt_get_stats(&crt, &st, 1);
+    printf("  dem: noise %.1f vsync %.1f hsync %.1f burst %.1f eq %.1f "
+           "rgb %.1f dup %.1f\n",
+           st.noise * us, st.vsync * us, st.hsync * us, st.burst * us,
+           st.eq * us, st.rgb * us, st.dup * us);
+    printf("  mod: blank %.1f sync %.1f active %.1f\n",
+           st.blank * us, st.sync * us, st.active * us);
+    printf("  sync search: %.0f + %.0f samples, %ld + %ld lost\n",
+           (double) st.vsync_iter / n, (double) st.hsync_iter / n,
+           st.vsync_lost, st.hsync_lost);
+}
+#endif
+
+static void
+bench(int w, int h, int noise, int blend, double secs, unsigned char *out)
+{
+    clock_t t0, t1, tm = 0, td = 0, limit;
+    double mod, dem, nsmp, npx;
+    int n = 0;
+
+    setup(w, h, out, blend);
+
+    /* warm up caches and the sync/burst state */
+    for (n = 0; n < 4; n++) {
+        next_field(n);
+        crt_modulate(&crt, &ntsc);
+        crt_demodulate(&crt, noise);
+    }
+    limit = (clock_t) (secs * CLOCKS_PER_SEC);
+#if CRT_DO_STATS
+    {
+        struct CRT_STATS st;
+        
+        crt_get_stats(&crt, &st, 1); /* just the timed fields */
+    }
+#endif
+    n = 0;
+    while ((tm + td) < limit || n < 4) {
+        next_field(n);
+        t0 = clock();
+        crt_modulate(&crt, &ntsc);
+        t1 = clock();
+        crt_demodulate(&crt, noise);
+        tm += t1 - t0;
+        td += clock() - t1;
+        n++;
+    }
+    mod = (double) tm / CLOCKS_PER_SEC / n;
+    dem = (double) td / CLOCKS_PER_SEC / n;
+    nsmp = (double) CRT_INPUT_SIZE;
+    npx = (double) w * h;
+    printf("%5dx%-5d %5d %5d %10.1f %10.3f %10.3f %10.3f\n",
+           w, h, noise, blend,
+           1.0 / (mod + dem),
+           mod * 1e9 / nsmp,
+           dem * 1e9 / nsmp,
+           dem * 1e9 / npx);
+#if CRT_DO_STATS
+    print_stats(n);
+#endif
+    fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned char *out, *sout;
+    double secs = 1.0;
+    int i, noise, blend;
+
+    printf(DRV_HEADER);
+    if (argc > 1) {
+        secs = atof(argv[1]);
+        if (secs <= 0.0) {
+            printf("usage: %s [seconds per test]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    out = calloc(sizes[2][0] * sizes[2][1], 4);
+    sout = calloc(sizes[0][0] * sizes[0][1], 4);
+    if (out == NULL || sout == NULL) {
+        printf("out of memory\n");
+        return EXIT_FAILURE;
+    }
+    make_pattern();
+    for (noise = 0; noise <= 24; noise += 24) {
+        if (!check_stream(sizes[0][0], sizes[0][1], noise, out, sout)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("system: %s, %dx%d input, %d samples per field\n",
+           sysnames[CRT_SYSTEM], IMG_W, IMG_H, CRT_INPUT_SIZE);
+    printf("%-11s %5s %5s %10s %10s %10s %10s\n",
+           "output", "noise", "blend",
+           "fields/s", "mod ns/smp", "dem ns/smp", "dem ns/px");
+    for (i = 0; i < (int) (sizeof(sizes) / sizeof(*sizes)); i++) {
+        for (noise = 0; noise <= 24; noise += 24) {
+            for (blend = 0; blend <= 1; blend++) {
+                bench(sizes[i][0], sizes[i][1], noise, blend, secs, out);
+            }
+        }
+    }
+    free(out);
+    free(sout);
+    return EXIT_SUCCESS;
+}
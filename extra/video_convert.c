@@ -14,20 +14,89 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 #include "bmp_rw.h"
 #include "crt_core.h"
 
+/* 1 = when streaming, read, emulate, and write frames on separate threads
+ * 0 = do everything on one thread
+ */
+#ifndef VC_THREADED
+#define VC_THREADED 1
+#endif
+
+#if VC_THREADED
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE             THREAD;
+typedef CRITICAL_SECTION   MUTEX;
+typedef CONDITION_VARIABLE COND;
+#define THREAD_FUNC(name, arg) static DWORD WINAPI name(LPVOID arg)
+#define THREAD_RETURN          return 0
+#define thread_start(t, f, a)  ((*(t) = CreateThread(NULL, 0, f, a, 0, NULL)) != NULL)
+#define thread_join(t)         (WaitForSingleObject(t, INFINITE), CloseHandle(t))
+#define mutex_init(m)          InitializeCriticalSection(m)
+#define mutex_free(m)          DeleteCriticalSection(m)
+#define mutex_lock(m)          EnterCriticalSection(m)
+#define mutex_unlock(m)        LeaveCriticalSection(m)
+#define cond_init(c)           InitializeConditionVariable(c)
+#define cond_free(c)
+#define cond_wait(c, m)        SleepConditionVariableCS(c, m, INFINITE)
+#define cond_broadcast(c)      WakeAllConditionVariable(c)
+#else
+#include <pthread.h>
+typedef pthread_t          THREAD;
+typedef pthread_mutex_t    MUTEX;
+typedef pthread_cond_t     COND;
+#define THREAD_FUNC(name, arg) static void *name(void *arg)
+#define THREAD_RETURN          return NULL
+#define thread_start(t, f, a)  (pthread_create(t, NULL, f, a) == 0)
+#define thread_join(t)         pthread_join(t, NULL)
+#define mutex_init(m)          pthread_mutex_init(m, NULL)
+#define mutex_free(m)          pthread_mutex_destroy(m)
+#define mutex_lock(m)          pthread_mutex_lock(m)
+#define mutex_unlock(m)        pthread_mutex_unlock(m)
+#define cond_init(c)           pthread_cond_init(c, NULL)
+#define cond_free(c)           pthread_cond_destroy(c)
+#define cond_wait(c, m)        pthread_cond_wait(c, m)
+#define cond_broadcast(c)      pthread_cond_broadcast(c)
+#endif
+
+/* number of frame buffers in each ring (frames in flight between stages)
+ * when there is only one CRT worker */
+#define RING_LEN 4
+
+/* with more than one worker, the stream is split into chunks of CHUNK_LEN
+ * frames that get emulated in parallel, each on its own CRT. a worker first
+ * emulates the WARMUP_LEN frames before its chunk (without outputting them)
+ * so its sync, color burst, and blending state match what a single CRT
+ * would have had. the rings then hold about (workers * CHUNK_LEN) frames
+ */
+#define CHUNK_LEN  16
+#define WARMUP_LEN 3
+#define MAX_WORKERS 256
+#endif
+
 /* First, configure the system you want to emulate by changing the value of
  * 'CRT_SYSTEM' inside crt_core.h
  *
  * Then compile this program using:
- * cc -O3 -o ntscvideo video_convert.c crt_core.c crt_ntsc.c crt_ntscvhs.c crt_pv1k.c crt_template.c bmp_rw.c
+ * cc -O3 -o ntscvideo video_convert.c crt_core.c crt_ntsc.c crt_ntscvhs.c crt_pv1k.c crt_template.c bmp_rw.c -lpthread
+ * (or with -DVC_THREADED=0 to build it without threads)
  * 
  * mkdir frames
  * mkdir output
  * ffmpeg -r 1 -i your_video.mov -r 1 ./frames/$frame%06d.bmp
  * ./ntscvideo <arguments>
  * ffmpeg -r 30 -f image2 -s 640x480 -i ./output/%06d.bmp -vcodec libx264 -crf 10 -pix_fmt yuv420p out.mp4
+ *
+ * or stream raw frames through it without any intermediate files:
+ * ffmpeg -i your_video.mov -f rawvideo -pix_fmt bgra - |
+ *   ./ntscvideo -r 0 640 480 0 720 480 |
+ *   ffmpeg -f rawvideo -pix_fmt bgra -s 640x480 -r 30 -i - -vcodec libx264 -crf 10 -pix_fmt yuv420p out.mp4
  */
 
 #if (CRT_SYSTEM == CRT_SYSTEM_NES)
@@ -41,6 +110,12 @@ static int dooverwrite = 1;
 static int docolor = 1;
 static int progressive = 0;
 static int scanlines = 1;
+static int dostream = 0;
+static int dorgb24 = 0;
+#if VC_THREADED
+static int nworkers = 1;
+#endif
+static FILE *msgs; /* stdout, or stderr when stdout is used for video */
 #if (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
 static int doaberration = 0;
 #endif
@@ -55,13 +130,13 @@ stoint(char *s, int *err)
     *err = 0;
     val = strtol(s, &tail, 10);
     if (errno == ERANGE) {
-        printf("integer out of integer range\n");
+        fprintf(msgs, "integer out of integer range\n");
         *err = 1;
     } else if (errno != 0) {
-        printf("bad string: %s\n", strerror(errno));
+        fprintf(msgs, "bad string: %s\n", strerror(errno));
         *err = 1;
     } else if (*tail != '\0') {
-        printf("integer contained non-numeric characters\n");
+        fprintf(msgs, "integer contained non-numeric characters\n");
         *err = 1;
     }
     return val;
@@ -71,22 +146,30 @@ static void
 usage(char *p)
 {
 #if (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
-    printf("usage: %s -m|o|a|p|s|h num_frames outwidth outheight noise\n", p);
+    fprintf(msgs, "usage: %s -m|o|a|p|s|r|3|h num_frames outwidth outheight noise [inwidth inheight]\n", p);
 #else
-    printf("usage: %s -m|o|p|s|h num_frames outwidth outheight noise\n", p);
+    fprintf(msgs, "usage: %s -m|o|p|s|r|3|h num_frames outwidth outheight noise [inwidth inheight]\n", p);
 #endif
-    printf("sample usage: %s -oa 5000 640 480 0\n", p);
-    printf("sample usage: %s - 1400 832 624 12\n", p);
-    printf("-- NOTE: the - after the program name is required\n");
-    printf("------------------------------------------------------------\n");
-    printf("\tm : monochrome\n");
-    printf("\to : do not prompt when overwriting files\n");
-    printf("\ta : mess up the bottom of the frame (useful for the VHS look)\n");
-    printf("\ts : fill in gaps between scan lines\n");
-    printf("\tp : progressive scan (rather than interlaced)\n");
-    printf("\th : print help\n");
-    printf("\n");
-    printf("by default, the image will be full color and interlaced\n");
+    fprintf(msgs, "sample usage: %s -oa 5000 640 480 0\n", p);
+    fprintf(msgs, "sample usage: %s - 1400 832 624 12\n", p);
+    fprintf(msgs, "sample usage: %s -r 0 640 480 8 720 480\n", p);
+    fprintf(msgs, "-- NOTE: the - after the program name is required\n");
+    fprintf(msgs, "------------------------------------------------------------\n");
+    fprintf(msgs, "\tm : monochrome\n");
+    fprintf(msgs, "\to : do not prompt when overwriting files\n");
+    fprintf(msgs, "\ta : mess up the bottom of the frame (useful for the VHS look)\n");
+    fprintf(msgs, "\ts : fill in gaps between scan lines\n");
+    fprintf(msgs, "\tp : progressive scan (rather than interlaced)\n");
+    fprintf(msgs, "\tr : stream raw inwidth x inheight BGRA frames from stdin\n");
+    fprintf(msgs, "\t    and write raw outwidth x outheight frames to stdout\n");
+    fprintf(msgs, "\t    (num_frames 0 = until the end of the input)\n");
+    fprintf(msgs, "\t3 : raw frames are 24-bit RGB (rgb24) instead of BGRA\n");
+#if VC_THREADED
+    fprintf(msgs, "\tjN: emulate the stream on N CRTs in parallel (e.g. -rj8)\n");
+#endif
+    fprintf(msgs, "\th : print help\n");
+    fprintf(msgs, "\n");
+    fprintf(msgs, "by default, the image will be full color and interlaced\n");
 }
 
 static int
@@ -107,6 +190,19 @@ process_args(int argc, char **argv)
 #endif
             case 's': scanlines = 0;    break;
             case 'p': progressive = 1;  break;
+            case 'r': dostream = 1;     break;
+            case '3': dorgb24 = 1;      break;
+#if VC_THREADED
+            case 'j':
+                nworkers = strtol(flags + 1, &flags, 10);
+                if (nworkers < 1 || nworkers > MAX_WORKERS) {
+                    fprintf(stderr, "j needs a number of workers (1-%d)\n",
+                            MAX_WORKERS);
+                    return 0;
+                }
+                flags--;
+                break;
+#endif
             case 'h': usage(argv[0]); return 0;
             default:
                 fprintf(stderr, "Unrecognized flag '%c'\n", *flags);
@@ -133,7 +229,7 @@ promptoverwrite(char *fn)
     if (dooverwrite && fileexist(fn)) {
         do {
             char c = 0;
-            printf("\n--- file (%s) already exists, overwrite? (y/n)\n", fn);
+            fprintf(msgs, "\n--- file (%s) already exists, overwrite? (y/n)\n", fn);
             scanf(" %c", &c);
             if (c == 'y' || c == 'Y') {
                 return 1;
@@ -146,6 +242,405 @@ promptoverwrite(char *fn)
     return 1;
 }
 
+/* read exactly n bytes, returns 0 at the end of the stream */
+static int
+read_frame(FILE *fp, unsigned char *buf, size_t n)
+{
+    size_t got = 0;
+    
+    while (got < n) {
+        size_t r = fread(buf + got, 1, n - got, fp);
+        if (r == 0) {
+            if (got != 0) {
+                fprintf(msgs, "incomplete frame at the end of the input\n");
+            }
+            return 0;
+        }
+        got += r;
+    }
+    return 1;
+}
+
+static int
+write_frame(FILE *fp, unsigned char *buf, size_t n)
+{
+    if (fwrite(buf, 1, n, fp) != n) {
+        return 0;
+    }
+    return 1;
+}
+
+/* emulate the n-th field of the stream */
+static void
+emulate_field(struct CRT *crt, struct NTSC_SETTINGS *ntsc, int noise, int n)
+{
+    if (!progressive) {
+        /* a frame is two fields */
+        ntsc->field = n & 1;
+        ntsc->frame = (n >> 1) & 1;
+    }
+    crt_modulate(crt, ntsc);
+    crt_demodulate(crt, noise);
+}
+
+#if VC_THREADED
+/* pipeline:
+ *   reader  - stdin -> input ring
+ *   workers - input ring -> CRT -> output ring
+ *   writer  - output ring -> stdout (in frame order)
+ * each stage only touches the ring slots that the counters below give it,
+ * so the lock is only held to update/wait on the counters
+ */
+struct PIPE {
+    int nframes;
+    int noise;
+    int seed;     /* noise seed (CRT.rn) of the configured CRT */
+#if (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
+    int vhs_seed; /* aberration seed (NTSC_SETTINGS.rn) */
+#endif
+    int chunk;    /* frames per chunk */
+    int warmup;   /* frames emulated before each chunk */
+    int inlen;    /* slots in the input ring */
+    int outlen;   /* slots in the output ring */
+    size_t insz, outsz;
+    unsigned char **in;
+    unsigned char **out;
+    int *users;   /* input slot: chunks that still need the frame in it */
+    int *ready;   /* output slot: frame number + 1 once it has been drawn */
+    int nread;    /* frames read into the input ring */
+    int nwritten; /* frames written from the output ring */
+    int nchunks;  /* chunks handed out to the workers */
+    int nworking; /* workers that are still running */
+    int eof;      /* reader has no more frames */
+    int error;
+    MUTEX lock;
+    COND cond;
+};
+
+struct WORKER {
+    struct PIPE *p;
+    struct CRT crt;
+    struct NTSC_SETTINGS ntsc;
+    THREAD thread;
+};
+
+static void
+pipe_signal(struct PIPE *p, int *counter, int value)
+{
+    mutex_lock(&p->lock);
+    *counter = value;
+    cond_broadcast(&p->cond);
+    mutex_unlock(&p->lock);
+}
+
+THREAD_FUNC(reader_thread, arg)
+{
+    struct PIPE *p = arg;
+    int n = 0;
+    
+    for (;;) {
+        int stop, slot = n % p->inlen;
+        
+        mutex_lock(&p->lock);
+        while (p->users[slot] > 0 && !p->error) {
+            cond_wait(&p->cond, &p->lock);
+        }
+        stop = p->error || (p->nframes != 0 && n >= p->nframes);
+        mutex_unlock(&p->lock);
+        if (stop || !read_frame(stdin, p->in[slot], p->insz)) {
+            break;
+        }
+        mutex_lock(&p->lock);
+        p->users[slot] = 1;
+        if ((n % p->chunk) >= (p->chunk - p->warmup)) {
+            /* the next chunk warms up with it too */
+            p->users[slot]++;
+        }
+        p->nread = ++n;
+        cond_broadcast(&p->cond);
+        mutex_unlock(&p->lock);
+    }
+    pipe_signal(p, &p->eof, 1);
+    THREAD_RETURN;
+}
+
+THREAD_FUNC(worker_thread, arg)
+{
+    struct WORKER *w = arg;
+    struct PIPE *p = w->p;
+    int lo, beg, end, n, salt;
+    
+    for (;;) {
+        mutex_lock(&p->lock);
+        beg = p->nchunks++ * p->chunk;
+        mutex_unlock(&p->lock);
+        end = beg + p->chunk;
+        lo = beg - p->warmup;
+        if (lo < 0) {
+            lo = 0;
+        }
+        /* every chunk gets its own noise (and VHS aberration), otherwise
+         * the chunks that are emulated at the same time would all repeat
+         * the same sequence */
+        salt = (int) (((unsigned long) beg * 2654435761UL) & 0x7fffffff);
+        w->crt.rn = p->seed ^ salt;
+#if (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
+        w->ntsc.rn = p->vhs_seed ^ salt;
+#endif
+        for (n = lo; n < end; n++) {
+            int stop, slot = n % p->inlen;
+            
+            mutex_lock(&p->lock);
+            while (n >= p->nread && !p->eof && !p->error) {
+                cond_wait(&p->cond, &p->lock);
+            }
+            stop = p->error || n >= p->nread;
+            mutex_unlock(&p->lock);
+            if (stop) {
+                goto done;
+            }
+            w->ntsc.data = p->in[slot];
+            emulate_field(&w->crt, &w->ntsc, p->noise, n);
+            
+            mutex_lock(&p->lock);
+            p->users[slot]--;
+            cond_broadcast(&p->cond);
+            if (n < beg) {
+                /* warm-up frame, not part of this chunk's output */
+                mutex_unlock(&p->lock);
+                continue;
+            }
+            while ((n - p->nwritten) >= p->outlen && !p->error) {
+                cond_wait(&p->cond, &p->lock);
+            }
+            stop = p->error;
+            mutex_unlock(&p->lock);
+            if (stop) {
+                goto done;
+            }
+            /* the CRT keeps drawing over its own image (blending, scanlines)
+             * so give the writer a copy of it */
+            memcpy(p->out[n % p->outlen], w->crt.out, p->outsz);
+            pipe_signal(p, &p->ready[n % p->outlen], n + 1);
+        }
+    }
+done:
+    mutex_lock(&p->lock);
+    p->nworking--;
+    cond_broadcast(&p->cond);
+    mutex_unlock(&p->lock);
+    THREAD_RETURN;
+}
+
+THREAD_FUNC(writer_thread, arg)
+{
+    struct PIPE *p = arg;
+    int n = 0;
+    
+    for (;;) {
+        int stop, slot = n % p->outlen;
+        
+        mutex_lock(&p->lock);
+        while (p->ready[slot] != (n + 1) && p->nworking > 0 && !p->error) {
+            cond_wait(&p->cond, &p->lock);
+        }
+        stop = p->error || p->ready[slot] != (n + 1);
+        mutex_unlock(&p->lock);
+        if (stop) {
+            break;
+        }
+        if (!write_frame(stdout, p->out[slot], p->outsz)) {
+            fprintf(msgs, "unable to write frame %d\n", n);
+            pipe_signal(p, &p->error, 1);
+            break;
+        }
+        pipe_signal(p, &p->nwritten, ++n);
+    }
+    fflush(stdout);
+    THREAD_RETURN;
+}
+
+/* raw frames in on stdin and out on stdout, frames get read while others
+ * are being emulated and written
+ */
+static int
+convert_stream(struct CRT *crt, struct NTSC_SETTINGS *ntsc,
+               int nframes, int noise, int inw, int inh)
+{
+    static struct PIPE p;
+    struct WORKER *workers;
+    THREAD reader, writer;
+    int i, nstarted = 0, ok = 0;
+    
+    memset(&p, 0, sizeof(p));
+    p.nframes = nframes;
+    p.noise = noise;
+    p.seed = crt->rn;
+#if (CRT_SYSTEM == CRT_SYSTEM_NTSCVHS)
+    p.vhs_seed = ntsc->rn;
+#endif
+    if (nworkers == 1) {
+        /* one CRT does it all, exactly like the single threaded path */
+        p.chunk = 0x7fffffff;
+        p.warmup = 0;
+        p.inlen = RING_LEN;
+        p.outlen = RING_LEN;
+    } else {
+        p.chunk = CHUNK_LEN;
+        p.warmup = WARMUP_LEN;
+        p.inlen = nworkers * CHUNK_LEN + WARMUP_LEN;
+        p.outlen = nworkers * CHUNK_LEN;
+    }
+    p.insz = (size_t) inw * inh * crt_bpp4fmt(ntsc->format);
+    p.outsz = (size_t) crt->outw * crt->outh * crt_bpp4fmt(crt->out_format);
+    p.in = calloc(p.inlen, sizeof(*p.in));
+    p.out = calloc(p.outlen, sizeof(*p.out));
+    p.users = calloc(p.inlen, sizeof(*p.users));
+    p.ready = calloc(p.outlen, sizeof(*p.ready));
+    workers = calloc(nworkers, sizeof(*workers));
+    if (!p.in || !p.out || !p.users || !p.ready || !workers) {
+        fprintf(msgs, "out of memory\n");
+        goto done;
+    }
+    for (i = 0; i < p.inlen; i++) {
+        if ((p.in[i] = malloc(p.insz)) == NULL) {
+            fprintf(msgs, "out of memory\n");
+            goto done;
+        }
+    }
+    for (i = 0; i < p.outlen; i++) {
+        if ((p.out[i] = malloc(p.outsz)) == NULL) {
+            fprintf(msgs, "out of memory\n");
+            goto done;
+        }
+    }
+    ntsc->w = inw;
+    ntsc->h = inh;
+    for (i = 0; i < nworkers; i++) {
+        /* every worker gets its own copy of the configured CRT */
+        workers[i].p = &p;
+        workers[i].crt = *crt;
+        /* the copy still points at crt's signal buffers, use its own */
+#if CRT_COMPACT
+        crt_set_buffers(&workers[i].crt, workers[i].crt.analog_buf, NULL);
+#else
+        crt_set_buffers(&workers[i].crt, workers[i].crt.analog_buf,
+                        workers[i].crt.inp_buf);
+#endif
+        workers[i].ntsc = *ntsc;
+        workers[i].crt.out = calloc(1, p.outsz);
+        if (workers[i].crt.out == NULL) {
+            fprintf(msgs, "out of memory\n");
+            goto done;
+        }
+    }
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    mutex_init(&p.lock);
+    cond_init(&p.cond);
+    p.nworking = nworkers;
+    if (!thread_start(&reader, reader_thread, &p)) {
+        fprintf(msgs, "unable to start reader thread\n");
+        goto done_sync;
+    }
+    for (i = 0; i < nworkers; i++) {
+        if (!thread_start(&workers[i].thread, worker_thread, &workers[i])) {
+            fprintf(msgs, "unable to start worker thread\n");
+            break;
+        }
+        nstarted++;
+    }
+    if (nstarted < nworkers) {
+        mutex_lock(&p.lock);
+        p.error = 1;
+        p.nworking -= nworkers - nstarted;
+        cond_broadcast(&p.cond);
+        mutex_unlock(&p.lock);
+    }
+    if (!thread_start(&writer, writer_thread, &p)) {
+        fprintf(msgs, "unable to start writer thread\n");
+        pipe_signal(&p, &p.error, 1);
+    } else {
+        thread_join(writer);
+    }
+    for (i = 0; i < nstarted; i++) {
+        thread_join(workers[i].thread);
+    }
+    if (p.error) {
+        /* the reader may be stuck waiting on stdin, leave it be */
+        fprintf(msgs, "%d frames\n", p.nwritten);
+        return 0;
+    }
+    thread_join(reader);
+    ok = 1;
+    fprintf(msgs, "%d frames\n", p.nwritten);
+done_sync:
+    mutex_free(&p.lock);
+    cond_free(&p.cond);
+done:
+    if (workers) {
+        for (i = 0; i < nworkers; i++) {
+            free(workers[i].crt.out);
+        }
+        free(workers);
+    }
+    for (i = 0; p.in && i < p.inlen; i++) {
+        free(p.in[i]);
+    }
+    for (i = 0; p.out && i < p.outlen; i++) {
+        free(p.out[i]);
+    }
+    free(p.in);
+    free(p.out);
+    free(p.users);
+    free(p.ready);
+    return ok;
+}
+#else
+/* raw frames in on stdin and out on stdout, the same input and output
+ * buffers are used for every frame
+ */
+static int
+convert_stream(struct CRT *crt, struct NTSC_SETTINGS *ntsc,
+               int nframes, int noise, int inw, int inh)
+{
+    unsigned char *img;
+    size_t insz, outsz;
+    int n = 0;
+    
+    insz = (size_t) inw * inh * crt_bpp4fmt(ntsc->format);
+    outsz = (size_t) crt->outw * crt->outh * crt_bpp4fmt(crt->out_format);
+    img = malloc(insz);
+    if (img == NULL) {
+        fprintf(msgs, "out of memory\n");
+        return 0;
+    }
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    ntsc->data = img;
+    ntsc->w = inw;
+    ntsc->h = inh;
+    
+    while ((nframes == 0 || n < nframes) && read_frame(stdin, img, insz)) {
+        emulate_field(crt, ntsc, noise, n);
+        if (!write_frame(stdout, crt->out, outsz)) {
+            fprintf(msgs, "unable to write frame %d\n", n);
+            free(img);
+            return 0;
+        }
+        n++;
+    }
+    fflush(stdout);
+    free(img);
+    fprintf(msgs, "%d frames\n", n);
+    return 1;
+}
+#endif
+
 int
 main(int argc, char **argv)
 {
@@ -154,27 +649,19 @@ main(int argc, char **argv)
     struct CRT crt;
     int *img = NULL;
     int imgw, imgh;
+    int imgcap = 0; /* size of img in pixels */
     int *output = NULL;
     int outw = 640;
     int outh = 480;
+    int inw = 0;
+    int inh = 0;
+    int fmt = CRT_PIX_FORMAT_BGRA;
     int noise = 12;
     int err = 0;
     int nframes = 0;
     
-    printf(DRV_HEADER);
-    printf("This program does not operate on video files, only sequences of\n");
-    printf("images. Please make sure you have the FFMPEG command line tools\n");
-    printf("installed and follow these instructions to convert a video\n");
-    printf("using the NTSC/CRT library:\n");
-    printf("  mkdir frames\n");
-    printf("  mkdir output\n");
-    printf("  ffmpeg -r 1 -i your_video.mov -r 1 ./frames/$frame%%06d.bmp\n");
-    printf("  ./%s <arguments>\n", argv[0]);
-    printf("  ffmpeg -r 30 -f image2 -s 640x480 -i ./output/%%06d.bmp -vcodec libx264 -crf 10 -pix_fmt yuv420p out.mp4\n");
-    printf("\n");
-    printf("------------------------------------------------------------\n");
-
-    if (argc < 5) {
+    msgs = stdout;
+    if (argc < 6) {
         usage(argv[0]);
         return EXIT_FAILURE;
     }
@@ -182,13 +669,32 @@ main(int argc, char **argv)
     if (!process_args(argc, argv)) {
         return EXIT_FAILURE;
     }
+    if (dostream) {
+        /* stdout is the video */
+        msgs = stderr;
+    }
+    
+    fprintf(msgs, DRV_HEADER);
+    if (!dostream) {
+        fprintf(msgs, "This program does not operate on video files, only sequences of\n");
+        fprintf(msgs, "images. Please make sure you have the FFMPEG command line tools\n");
+        fprintf(msgs, "installed and follow these instructions to convert a video\n");
+        fprintf(msgs, "using the NTSC/CRT library:\n");
+        fprintf(msgs, "  mkdir frames\n");
+        fprintf(msgs, "  mkdir output\n");
+        fprintf(msgs, "  ffmpeg -r 1 -i your_video.mov -r 1 ./frames/$frame%%06d.bmp\n");
+        fprintf(msgs, "  ./%s <arguments>\n", argv[0]);
+        fprintf(msgs, "  ffmpeg -r 30 -f image2 -s 640x480 -i ./output/%%06d.bmp -vcodec libx264 -crf 10 -pix_fmt yuv420p out.mp4\n");
+        fprintf(msgs, "\n");
+        fprintf(msgs, "------------------------------------------------------------\n");
+    }
 
     nframes = stoint(argv[2], &err);
     if (err) {
         return EXIT_FAILURE;
     }
-    if (nframes <= 0) {
-        printf("num_frames must be greater than 0!\n");
+    if (nframes < 0 || (nframes == 0 && !dostream)) {
+        fprintf(msgs, "num_frames must be greater than 0!\n");
         return EXIT_FAILURE;
     }
     outw = stoint(argv[3], &err);
@@ -196,7 +702,7 @@ main(int argc, char **argv)
         return EXIT_FAILURE;
     }
     if (outw <= 0) {
-        printf("outwidth must be greater than 0!\n");
+        fprintf(msgs, "outwidth must be greater than 0!\n");
         return EXIT_FAILURE;
     }
     outh = stoint(argv[4], &err);
@@ -204,7 +710,7 @@ main(int argc, char **argv)
         return EXIT_FAILURE;
     }
     if (outh <= 0) {
-        printf("outheight must be greater than 0!\n");
+        fprintf(msgs, "outheight must be greater than 0!\n");
         return EXIT_FAILURE;
     }
     noise = stoint(argv[5], &err);
@@ -213,19 +719,43 @@ main(int argc, char **argv)
     }
 
     if (noise < 0) noise = 0;
+    
+    if (dostream) {
+        if (argc < 8) {
+            fprintf(msgs, "streaming needs the input width and height!\n");
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        inw = stoint(argv[6], &err);
+        if (err) {
+            return EXIT_FAILURE;
+        }
+        inh = stoint(argv[7], &err);
+        if (err) {
+            return EXIT_FAILURE;
+        }
+        if (inw <= 0 || inh <= 0) {
+            fprintf(msgs, "inwidth and inheight must be greater than 0!\n");
+            return EXIT_FAILURE;
+        }
+        if (dorgb24) {
+            fmt = CRT_PIX_FORMAT_RGB;
+        }
+    }
 
     /* seed standard library PRNG */
     srand(time(0));
     
     output = calloc(outw * outh, sizeof(int));
     if (output == NULL) {
-        printf("out of memory\n");
+        fprintf(msgs, "out of memory\n");
         return EXIT_FAILURE;
     }
 
-    crt_init(&crt, outw, outh, CRT_PIX_FORMAT_BGRA, output);
+    crt_init(&crt, outw, outh, fmt, (unsigned char *) output);
 
-    ntsc.format = CRT_PIX_FORMAT_BGRA;
+    memset(&ntsc, 0, sizeof(ntsc));
+    ntsc.format = fmt;
 
     ntsc.as_color = docolor;
     ntsc.field = 0;
@@ -240,20 +770,34 @@ main(int argc, char **argv)
     crt.scanlines = scanlines;
     crt.saturation = 10;
 
-    printf("converting to %dx%d...\n", outw, outh);
-    err = 1;
+    fprintf(msgs, "converting to %dx%d...\n", outw, outh);
+    
+    if (dostream) {
+        err = convert_stream(&crt, &ntsc, nframes, noise, inw, inh);
+        free(output);
+        return err ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
     
+    err = 1;
     while (err < nframes) {
-        if (img != NULL) {
-            free(img);
-            img = NULL;
-        }
         sprintf(buf, "frames/%06d.bmp", err);
-        if (!bmp_read24(buf, &img, &imgw, &imgh, calloc)) {
-            printf("unable to read image %s\n", buf);
-            return EXIT_FAILURE;
+        /* frames are read into the same buffer, it only grows when a
+         * larger frame comes along */
+        imgw = imgh = 0;
+        if (!bmp_read24_buf(buf, img, imgcap, &imgw, &imgh)) {
+            if (imgw * imgh <= imgcap) {
+                fprintf(msgs, "unable to read image %s\n", buf);
+                return EXIT_FAILURE;
+            }
+            free(img);
+            imgcap = 0;
+            if (!bmp_read24(buf, &img, &imgw, &imgh, calloc)) {
+                fprintf(msgs, "unable to read image %s\n", buf);
+                return EXIT_FAILURE;
+            }
+            imgcap = imgw * imgh;
         }
-        ntsc.data = img;
+        ntsc.data = (unsigned char *) img;
         ntsc.w = imgw;
         ntsc.h = imgh;
         crt_modulate(&crt, &ntsc);
@@ -268,14 +812,14 @@ main(int argc, char **argv)
         sprintf(buf, "output/%06d.bmp", err);
         if (promptoverwrite(buf)) {
             if (!bmp_write24(buf, output, outw, outh)) {
-                printf("unable to write image %s\n", buf);
+                fprintf(msgs, "unable to write image %s\n", buf);
                 return EXIT_FAILURE;
             }
         }
         err++;
-        printf("frame %d / %d\n", err, nframes);
+        fprintf(msgs, "frame %d / %d\n", err, nframes);
     }
     
-    printf("done\n");
+    fprintf(msgs, "done\n");
     return EXIT_SUCCESS;
 }
@@ -14,29 +14,18 @@
 
 #include "ppm_rw.h"
 
-extern int
-ppm_read24(char *file,
-           int **out_color, int *out_w, int *out_h,
-           void *(*calloc_func)(size_t, size_t))
- {
-    FILE *f;
-    long beg;
-    int *out;
-    int i, npix;
-    int r, g, b;
+#define PPM_CHUNK 256 /* pixels per fread/fwrite */
+
+static int
+read_header(FILE *f, char *file, int *out_w, int *out_h, int *maxc)
+{
     int header = 0;
     char buf[64];
-    int maxc = 0xff;
 
-    f = fopen(file, "rb");
-    if (f == NULL) {
-        printf("[ppm_rw] unable to open ppm: %s\n", file);
-        return 0;
-    }
     while (header < 3) {
         if (!fgets(buf, sizeof(buf), f)) {
             printf("[ppm_rw] invalid ppm [no data]: %s\n", file);
-            goto err;
+            return 0;
         }
         if (buf[0] == '#') {
             continue;
@@ -45,20 +34,21 @@ ppm_read24(char *file,
             case 0:
                 if (buf[0] != 'P' || buf[1] != '6') {
                     printf("[ppm_rw] invalid ppm [not P6]: %s\n", file);
-                    goto err;
+                    return 0;
                 }
                 break;
             case 1:
-                if (sscanf(buf, "%d %d", out_w, out_h) != 2) {
+                if (sscanf(buf, "%d %d", out_w, out_h) != 2 ||
+                    *out_w <= 0 || *out_h <= 0) {
                     printf("[ppm_rw] invalid ppm [no dim]: %s\n", file);
-                    goto err;
+                    return 0;
                 }
                 break;
             case 2:
-                maxc = atoi(buf);
-                if (maxc > 0xff) {
+                *maxc = atoi(buf);
+                if (*maxc > 0xff || *maxc <= 0) {
                     printf("[ppm_rw] invalid ppm [>255]: %s\n", file);
-                    goto err;
+                    return 0;
                 }
                 break;
             default:
@@ -66,28 +56,97 @@ ppm_read24(char *file,
         }
         header++;
     }
-           
-    beg = ftell(f);
-    npix = *out_w * *out_h;
-    *out_color = calloc_func(npix, sizeof(int));
+    return 1;
+}
+
+/* reads PPM_CHUNK pixels at a time */
+static int
+read_pixels(FILE *f, char *file, int *out, int npix, int maxc)
+{
+    unsigned char buf[PPM_CHUNK * 3];
+    unsigned char *p;
+    int i, n;
+    int r, g, b;
+
+    while (npix > 0) {
+        n = (npix < PPM_CHUNK) ? npix : PPM_CHUNK;
+        if (fread(buf, 3, n, f) != (size_t) n) {
+            printf("[ppm_rw] early eof: %s\n", file);
+            return 0;
+        }
+        p = buf;
+        if (maxc == 0xff) {
+            for (i = 0; i < n; i++, p += 3) {
+                out[i] = (p[0] << 16 | p[1] << 8 | p[2]);
+            }
+        } else {
+            for (i = 0; i < n; i++, p += 3) {
+#define TO_8_BIT(x) (((x) * 255 + (maxc) / 2) / (maxc))
+                r = TO_8_BIT(p[0]);
+                g = TO_8_BIT(p[1]);
+                b = TO_8_BIT(p[2]);
+                out[i] = (r << 16 | g << 8 | b);
+            }
+        }
+        out += n;
+        npix -= n;
+    }
+    return 1;
+}
+
+extern int
+ppm_read24(char *file,
+           int **out_color, int *out_w, int *out_h,
+           void *(*calloc_func)(size_t, size_t))
+ {
+    FILE *f;
+    int maxc = 0xff;
+
+    f = fopen(file, "rb");
+    if (f == NULL) {
+        printf("[ppm_rw] unable to open ppm: %s\n", file);
+        return 0;
+    }
+    if (!read_header(f, file, out_w, out_h, &maxc)) {
+        goto err;
+    }
+    *out_color = calloc_func((size_t) *out_w * *out_h, sizeof(int));
     if (*out_color == NULL) {
         printf("[ppm_rw] out of memory loading ppm: %s\n", file);
         goto err;
     }
-    out = *out_color;
-    /*printf("ppm 24-bit w: %d, h: %d, s: %d\n", *out_w, *out_h, npix);*/
-    for (i = 0; i < npix; i++) {
-#define TO_8_BIT(x) (((x) * 255 + (maxc) / 2) / (maxc))
-        r = TO_8_BIT(fgetc(f));
-        g = TO_8_BIT(fgetc(f));
-        b = TO_8_BIT(fgetc(f));
-        if (feof(f)) {
-            printf("[ppm_rw] early eof: %s\n", file);
-            goto err;
-        }
-        out[i] = (r << 16 | g << 8 | b);
+    /*printf("ppm 24-bit w: %d, h: %d\n", *out_w, *out_h);*/
+    if (!read_pixels(f, file, *out_color, *out_w * *out_h, maxc)) {
+        goto err;
+    }
+    fclose(f);
+    return 1;
+err:
+    fclose(f);
+    return 0;
+}
+
+extern int
+ppm_read24_buf(char *file, int *color, int maxpix, int *out_w, int *out_h)
+{
+    FILE *f;
+    int maxc = 0xff;
+
+    f = fopen(file, "rb");
+    if (f == NULL) {
+        printf("[ppm_rw] unable to open ppm: %s\n", file);
+        return 0;
+    }
+    if (!read_header(f, file, out_w, out_h, &maxc)) {
+        goto err;
+    }
+    if ((long) *out_w * *out_h > maxpix) {
+        printf("[ppm_rw] ppm too large for buffer: %s\n", file);
+        goto err;
+    }
+    if (!read_pixels(f, file, color, *out_w * *out_h, maxc)) {
+        goto err;
     }
-    fseek(f, beg, SEEK_SET);
     fclose(f);
     return 1;
 err:
@@ -99,7 +158,9 @@ extern int
 ppm_write24(char *name, int *color, int w, int h)
 {
     FILE *f;
-    int i, npix, c;
+    unsigned char buf[PPM_CHUNK * 3];
+    unsigned char *p;
+    int i, n, npix, c;
 
     f = fopen(name, "wb");
     if (f == NULL) {
@@ -109,12 +170,20 @@ ppm_write24(char *name, int *color, int w, int h)
 
     fprintf(f, "P6\n%d %d\n255\n", w, h);
 
-    npix = w * h;
-    for (i = 0; i < npix; i++) {
-        c = *color++;
-        fputc((c >> 16 & 0xff), f);
-        fputc((c >> 8  & 0xff), f);
-        fputc((c >> 0  & 0xff), f);
+    for (npix = w * h; npix > 0; npix -= n) {
+        n = (npix < PPM_CHUNK) ? npix : PPM_CHUNK;
+        p = buf;
+        for (i = 0; i < n; i++) {
+            c = *color++;
+            *p++ = (c >> 16 & 0xff);
+            *p++ = (c >> 8  & 0xff);
+            *p++ = (c >> 0  & 0xff);
+        }
+        if (fwrite(buf, 3, n, f) != (size_t) n) {
+            printf("[ppm_rw] failed to write file: %s\n", name);
+            fclose(f);
+            return 0;
+        }
     }
     fclose(f);
     return 1;
@@ -22,6 +22,14 @@ extern int ppm_read24(char *file,
         int *out_w, int *out_h,
         void *(*calloc_func)(size_t, size_t));
 
+/* Reads an image into a caller provided buffer of maxpix ints, no allocation.
+ * out_w and out_h are set as soon as the header is read, so if the image
+ * doesn't fit (returns 0) they give the size needed.
+ * returns 0 if the file can't be read or the image is larger than maxpix
+ */
+extern int ppm_read24_buf(char *file, int *color, int maxpix,
+        int *out_w, int *out_h);
+
 extern int ppm_write24(char *name, int *color, int w, int h);
 
 #endif
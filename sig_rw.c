@@ -0,0 +1,322 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sig_rw.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#define SIG_MMAP 1
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define SIG_MMAP 1
+#else
+#define SIG_MMAP 0 /* read the whole file into memory instead */
+#endif
+
+#define SIG_VERSION 1
+
+static void
+put32(unsigned char *p, long v)
+{
+    p[0] = (v >>  0) & 0xff;
+    p[1] = (v >>  8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static long
+get32(const unsigned char *p)
+{
+    unsigned long v;
+
+    v = (unsigned long) p[0] | ((unsigned long) p[1] << 8) |
+        ((unsigned long) p[2] << 16) | ((unsigned long) p[3] << 24);
+    /* sign extend */
+    if (v & 0x80000000UL) {
+        return -(long) (0xffffffffUL - v) - 1;
+    }
+    return (long) v;
+}
+
+static size_t
+field_size(struct SIG_FILE *f)
+{
+    return 4 + (size_t) 4 * f->cc_vper * f->cc_samples +
+           (size_t) f->hres * f->vres;
+}
+
+static int
+write_header(struct SIG_FILE *f)
+{
+    unsigned char hdr[SIG_HEADER_SIZE];
+
+    memcpy(hdr, "NSIG", 4);
+    put32(hdr + 4, SIG_VERSION);
+    put32(hdr + 8, f->system);
+    put32(hdr + 12, f->hres);
+    put32(hdr + 16, f->vres);
+    put32(hdr + 20, f->cc_vper);
+    put32(hdr + 24, f->cc_samples);
+    put32(hdr + 28, f->nfields);
+    return fwrite(hdr, 1, sizeof(hdr), f->fp) == sizeof(hdr);
+}
+
+extern int
+sig_create(struct SIG_FILE *f, char *name, int system,
+           int hres, int vres, int cc_vper, int cc_samples)
+{
+    memset(f, 0, sizeof(struct SIG_FILE));
+    f->system = system;
+    f->hres = hres;
+    f->vres = vres;
+    f->cc_vper = cc_vper;
+    f->cc_samples = cc_samples;
+
+    f->fp = fopen(name, "wb");
+    if (f->fp == NULL) {
+        printf("[sig_rw] unable to create signal file: %s\n", name);
+        return 0;
+    }
+    /* number of fields is filled in by sig_close() */
+    if (!write_header(f)) {
+        printf("[sig_rw] unable to write signal file: %s\n", name);
+        fclose(f->fp);
+        f->fp = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+extern int
+sig_write(struct SIG_FILE *f, const signed char *sig, int field,
+          const int *ccf)
+{
+    unsigned char buf[4];
+    int i, n;
+
+    if (f->fp == NULL) {
+        return 0;
+    }
+    put32(buf, field);
+    if (fwrite(buf, 1, 4, f->fp) != 4) {
+        return 0;
+    }
+    n = f->cc_vper * f->cc_samples;
+    for (i = 0; i < n; i++) {
+        put32(buf, ccf[i]);
+        if (fwrite(buf, 1, 4, f->fp) != 4) {
+            return 0;
+        }
+    }
+    n = f->hres * f->vres;
+    if (fwrite(sig, 1, n, f->fp) != (size_t) n) {
+        return 0;
+    }
+    f->nfields++;
+    return 1;
+}
+
+/* map (or load) the whole file */
+static int
+load_file(struct SIG_FILE *f, char *name)
+{
+#if SIG_MMAP && defined(_WIN32)
+    HANDLE fh, mh;
+    DWORD hi, lo;
+    size_t n;
+
+    fh = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL,
+                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    lo = GetFileSize(fh, &hi);
+    n = lo;
+    if (sizeof(size_t) > 4) {
+        n |= ((size_t) hi << 16) << 16;
+    } else if (hi != 0) {
+        n = 0; /* too big to map */
+    }
+    if ((lo == INVALID_FILE_SIZE && GetLastError() != NO_ERROR) ||
+        n < SIG_HEADER_SIZE) {
+        CloseHandle(fh);
+        return 0;
+    }
+    mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mh == NULL) {
+        CloseHandle(fh);
+        return 0;
+    }
+    f->data = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+    if (f->data == NULL) {
+        CloseHandle(mh);
+        CloseHandle(fh);
+        return 0;
+    }
+    f->fh = fh;
+    f->mh = mh;
+    f->size = n;
+    return 1;
+#elif SIG_MMAP
+    struct stat st;
+    void *p;
+    int fd;
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < SIG_HEADER_SIZE ||
+        (off_t) (size_t) st.st_size != st.st_size) {
+        close(fd);
+        return 0;
+    }
+    p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping stays */
+    if (p == MAP_FAILED) {
+        return 0;
+    }
+    f->data = p;
+    f->size = (size_t) st.st_size;
+    return 1;
+#else
+    FILE *fp;
+    unsigned char *p;
+    long n;
+
+    fp = fopen(name, "rb");
+    if (fp == NULL) {
+        return 0;
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (n = ftell(fp)) < SIG_HEADER_SIZE ||
+        fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return 0;
+    }
+    p = malloc(n);
+    if (p == NULL || fread(p, 1, n, fp) != (size_t) n) {
+        free(p);
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+    f->data = p;
+    f->size = (size_t) n;
+    return 1;
+#endif
+}
+
+static void
+unload_file(struct SIG_FILE *f)
+{
+    if (f->data == NULL) {
+        return;
+    }
+#if SIG_MMAP && defined(_WIN32)
+    UnmapViewOfFile((void *) f->data);
+    CloseHandle(f->mh);
+    CloseHandle(f->fh);
+#elif SIG_MMAP
+    munmap((void *) f->data, (size_t) f->size);
+#else
+    free((void *) f->data);
+#endif
+    f->data = NULL;
+}
+
+extern int
+sig_open(struct SIG_FILE *f, char *name)
+{
+    const unsigned char *h;
+    size_t fs;
+
+    memset(f, 0, sizeof(struct SIG_FILE));
+    if (!load_file(f, name)) {
+        printf("[sig_rw] unable to open signal file: %s\n", name);
+        return 0;
+    }
+    h = f->data;
+    if (memcmp(h, "NSIG", 4) != 0 || get32(h + 4) != SIG_VERSION) {
+        printf("[sig_rw] invalid signal file [not NSIG v%d]: %s\n",
+               SIG_VERSION, name);
+        goto err;
+    }
+    f->system = get32(h + 8);
+    f->hres = get32(h + 12);
+    f->vres = get32(h + 16);
+    f->cc_vper = get32(h + 20);
+    f->cc_samples = get32(h + 24);
+    f->nfields = get32(h + 28);
+    if (f->hres <= 0 || f->vres <= 0 || f->nfields < 0 ||
+        f->cc_vper <= 0 || f->cc_samples <= 0 ||
+        f->hres > 0x4000 || f->vres > 0x4000 ||
+        f->cc_vper > 0x100 || f->cc_samples > 0x100) {
+        printf("[sig_rw] invalid signal file [bad header]: %s\n", name);
+        goto err;
+    }
+    /* nfields * field size could overflow, divide instead */
+    fs = field_size(f);
+    if ((size_t) f->nfields > (f->size - SIG_HEADER_SIZE) / fs) {
+        printf("[sig_rw] invalid signal file [truncated]: %s\n", name);
+        goto err;
+    }
+    return 1;
+err:
+    unload_file(f);
+    return 0;
+}
+
+extern const signed char *
+sig_field(struct SIG_FILE *f, int n, int *field, int *ccf)
+{
+    const unsigned char *p;
+    int i, nc;
+
+    if (f->data == NULL || n < 0 || n >= f->nfields) {
+        return NULL;
+    }
+    p = f->data + SIG_HEADER_SIZE + (size_t) n * field_size(f);
+    if (field) {
+        *field = get32(p);
+    }
+    p += 4;
+    nc = f->cc_vper * f->cc_samples;
+    if (ccf) {
+        for (i = 0; i < nc; i++) {
+            ccf[i] = get32(p + i * 4);
+        }
+    }
+    return (const signed char *) (p + nc * 4);
+}
+
+extern int
+sig_close(struct SIG_FILE *f)
+{
+    int ok = 1;
+
+    if (f->fp != NULL) {
+        /* go back and fill in the number of fields */
+        ok = (fseek(f->fp, 0, SEEK_SET) == 0) && write_header(f);
+        if (fclose(f->fp) != 0) {
+            ok = 0;
+        }
+        f->fp = NULL;
+    }
+    unload_file(f);
+    return ok;
+}
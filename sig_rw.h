@@ -0,0 +1,89 @@
+/*****************************************************************************/
+/*
+ * NTSC/CRT - integer-only NTSC video signal encoding / decoding emulation
+ *
+ *   by EMMIR 2018-2023
+ *
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+#ifndef _SIG_RW_
+#define _SIG_RW_
+
+#include <stdio.h>
+
+/* sig_rw.h
+ *
+ * Routines to save modulated fields (CRT.analog) to a file and replay them.
+ * Replaying only needs crt_demodulate(), so the display settings (hue,
+ * saturation, contrast, noise, output size...) can be tuned over and over
+ * without modulating anything again. The file is memory mapped where the OS
+ * supports it, so the fields are read straight out of the file. Files of any
+ * size can be mapped by 64-bit programs (about 9000 NTSC fields fit in the
+ * 2 GB that 32-bit ones can map). Without memory mapping the whole file is
+ * read into memory instead, which limits it to 2 GB.
+ *
+ * File layout, all numbers are 32-bit little endian:
+ *   header:
+ *     'N' 'S' 'I' 'G', version (1), system (CRT_SYSTEM),
+ *     hres (CRT_HRES), vres (CRT_VRES),
+ *     cc_vper (CRT_CC_VPER), cc_samples (CRT_CC_SAMPLES), number of fields
+ *   then for every field:
+ *     field (0 = even, 1 = odd),
+ *     cc_vper * cc_samples color carrier values (CRT.ccf after crt_modulate)
+ *     hres * vres signed chars of signal (CRT.analog)
+ */
+
+#define SIG_HEADER_SIZE 32
+
+struct SIG_FILE {
+    int system; /* CRT_SYSTEM the signal was made with */
+    int hres, vres; /* samples per line, lines per field */
+    int cc_vper, cc_samples; /* size of the color carrier table */
+    int nfields;
+
+    /* internal */
+    FILE *fp; /* when writing */
+    const unsigned char *data; /* whole file when reading */
+    size_t size;
+#ifdef _WIN32
+    void *fh, *mh;
+#endif
+};
+
+/* Creates a signal file to write fields to.
+ * returns 0 if the file can't be created
+ */
+extern int sig_create(struct SIG_FILE *f, char *name, int system,
+                      int hres, int vres, int cc_vper, int cc_samples);
+
+/* Appends a field to a file made by sig_create()
+ *   sig   - hres * vres samples
+ *   field - 0 = even, 1 = odd
+ *   ccf   - cc_vper * cc_samples ints (&crt.ccf[0][0])
+ * returns 0 if it couldn't be written
+ */
+extern int sig_write(struct SIG_FILE *f, const signed char *sig, int field,
+                     const int *ccf);
+
+/* Opens a signal file for replaying.
+ * returns 0 if the file can't be read or is not a signal file
+ */
+extern int sig_open(struct SIG_FILE *f, char *name);
+
+/* Gets field n (0 to nfields - 1) of a file opened with sig_open()
+ *   field - receives 0 for even, 1 for odd (can be NULL)
+ *   ccf   - receives cc_vper * cc_samples ints (can be NULL)
+ * returns a pointer to its hres * vres samples, valid until sig_close()
+ */
+extern const signed char *sig_field(struct SIG_FILE *f, int n,
+                                    int *field, int *ccf);
+
+/* Closes a signal file, when writing this is where the number of fields
+ * gets filled in.
+ * returns 0 if writing it failed
+ */
+extern int sig_close(struct SIG_FILE *f);
+
+#endif